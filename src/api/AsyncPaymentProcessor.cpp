@@ -0,0 +1,339 @@
+#include "./AsyncPaymentProcessor.h"
+#include "./CircuitBreaker.h"
+#include "./ConcurrencyLimiter.h"
+#include "./Config.h"
+#include "./GatewayChooserService.h"
+#include "./PaymentProcessor.h"
+#include "./SignalHandling.h"
+#include "./Tracing.h"
+#include <format>
+#include <print>
+#include <cassert>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+
+namespace rinhaback::api
+{
+	std::jthread AsyncPaymentProcessor::start(std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue,
+		std::shared_ptr<RetryScheduler> retryScheduler, std::shared_ptr<PaymentService> paymentService)
+	{
+		const auto processor = std::make_shared<AsyncPaymentProcessor>();
+		processor->pendingPaymentsQueue = std::move(pendingPaymentsQueue);
+		processor->retryScheduler = std::move(retryScheduler);
+		processor->paymentService = std::move(paymentService);
+
+		return std::jthread([processor]() { processor->handler(); });
+	}
+
+	void AsyncPaymentProcessor::eventHandler(mg_connection* conn, int ev, void* evData)
+	{
+		const auto connection = static_cast<UpstreamConnection*>(conn->fn_data);
+		const auto processor = connection->processor;
+
+		switch (ev)
+		{
+			case MG_EV_CONNECT:
+				connection->connected = true;
+
+				if (connection->payment.has_value())
+					processor->sendPayment(*connection);
+				else
+				{
+					processor->upstreams[std::to_underlying(connection->gateway)].idleConnections.push_back(
+						connection);
+				}
+
+				break;
+
+			case MG_EV_READ:
+				connection->responseStarted = true;
+				break;
+
+			case MG_EV_HTTP_MSG:
+				processor->completePayment(*connection, mg_http_status(static_cast<mg_http_message*>(evData)));
+				break;
+
+			case MG_EV_POLL:
+				if (connection->payment.has_value() &&
+					std::chrono::steady_clock::now() - connection->assignedAt > Config::processorTimeout)
+				{
+					connection->timedOut = true;
+					conn->is_closing = 1;
+				}
+
+				break;
+
+			case MG_EV_CLOSE:
+				processor->closeConnection(connection);
+				break;
+		}
+	}
+
+	static std::chrono::microseconds getElapsed(std::chrono::steady_clock::time_point since)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since);
+	}
+
+	void AsyncPaymentProcessor::handler()
+	{
+		std::println("AsyncPaymentProcessor started.");
+
+		mg_mgr_init(&mgr);
+
+		upstreams[std::to_underlying(PaymentGateway::DEFAULT)].url = Config::processorDefaultUrl;
+		upstreams[std::to_underlying(PaymentGateway::FALLBACK)].url = Config::processorFallbackUrl;
+
+		for (auto& upstream : upstreams)
+			resolveUpstream(upstream);
+
+		while (!SignalHandling::shouldFinish())
+		{
+			// Nothing to watch, so sleep in the queue instead of spinning in the poll loop.
+			if (inFlightCount == 0 && readyPayments.empty())
+			{
+				if (const auto payment = pendingPaymentsQueue->dequeue())
+					readyPayments.push_back(payment.value());
+			}
+
+			// Process closes of idle connections that happened while blocked in the queue before reusing them.
+			mg_mgr_poll(&mgr, 0);
+
+			dispatch();
+
+			mg_mgr_poll(&mgr, POLL_TIME);
+		}
+
+		// Give in-flight payments a chance to complete.
+		const auto deadline = std::chrono::steady_clock::now() + SignalHandling::WAIT_TIME;
+
+		while (inFlightCount > 0 && std::chrono::steady_clock::now() < deadline)
+			mg_mgr_poll(&mgr, POLL_TIME);
+
+		mg_mgr_free(&mgr);
+
+		std::println("AsyncPaymentProcessor stopped.");
+	}
+
+	// mongoose would resolve names through its own DNS client (8.8.8.8 by default), which doesn't know the
+	// container names. Resolve them with the system resolver and connect to the address instead.
+	void AsyncPaymentProcessor::resolveUpstream(Upstream& upstream)
+	{
+		const auto now = std::chrono::steady_clock::now();
+
+		if (!upstream.address.empty() && now - upstream.resolvedAt < RESOLVE_INTERVAL)
+			return;
+
+		upstream.resolvedAt = now;
+		upstream.resolveNeeded = false;
+
+		const auto hostStr = mg_url_host(upstream.url.c_str());
+		const auto port = mg_url_port(upstream.url.c_str());
+
+		upstream.host.assign(hostStr.buf, hostStr.len);
+		upstream.address = upstream.url;
+
+		addrinfo hints{};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* addresses = nullptr;
+
+		if (getaddrinfo(upstream.host.c_str(), nullptr, &hints, &addresses) == 0 && addresses)
+		{
+			char ip[INET_ADDRSTRLEN];
+			const auto address = reinterpret_cast<const sockaddr_in*>(addresses->ai_addr);
+
+			if (inet_ntop(AF_INET, &address->sin_addr, ip, sizeof(ip)))
+				upstream.address = std::format("http://{}:{}", ip, port);
+		}
+
+		if (addresses)
+			freeaddrinfo(addresses);
+	}
+
+	void AsyncPaymentProcessor::dispatch()
+	{
+		do
+		{
+			const auto permit = CircuitBreaker::acquire(GatewayChooserService::getGateway());
+
+			if (!permit.has_value())
+				break;
+
+			const auto gateway = permit->gateway;
+			auto& upstream = upstreams[std::to_underlying(gateway)];
+
+			auto& limiter = ConcurrencyLimiter::get(gateway);
+
+			if (!limiter.tryAcquire())
+			{
+				CircuitBreaker::release(permit.value(), CircuitBreaker::Outcome::NEUTRAL);
+				break;
+			}
+
+			if (readyPayments.empty())
+			{
+				std::array<PendingPaymentsQueue::Payment, DEQUEUE_BATCH_SIZE> payments;
+				const auto count = pendingPaymentsQueue->tryDequeueBulk(payments);
+
+				readyPayments.insert(readyPayments.end(), payments.begin(), payments.begin() + count);
+			}
+
+			if (readyPayments.empty())
+			{
+				limiter.release();
+				CircuitBreaker::release(permit.value(), CircuitBreaker::Outcome::NEUTRAL);
+				break;
+			}
+
+			UpstreamConnection* connection;
+			bool reused = false;
+
+			if (!upstream.idleConnections.empty())
+			{
+				connection = upstream.idleConnections.back();
+				upstream.idleConnections.pop_back();
+				reused = true;
+			}
+			else
+			{
+				if (upstream.resolveNeeded)
+					resolveUpstream(upstream);
+
+				connection = new UpstreamConnection{.processor = this, .gateway = gateway};
+				connection->conn = mg_http_connect(&mgr, upstream.address.c_str(), eventHandler, connection);
+
+				if (!connection->conn)
+				{
+					delete connection;
+					limiter.release();
+					CircuitBreaker::release(permit.value(), CircuitBreaker::Outcome::NEUTRAL);
+					break;
+				}
+			}
+
+			connection->probe = permit->probe;
+			connection->reused = reused;
+			connection->responseStarted = false;
+			connection->payment = readyPayments.front();
+			connection->assignedAt = std::chrono::steady_clock::now();
+			readyPayments.pop_front();
+			++inFlightCount;
+
+			if (connection->connected)
+				sendPayment(*connection);
+		} while (true);
+	}
+
+	void AsyncPaymentProcessor::sendPayment(UpstreamConnection& connection)
+	{
+		assert(connection.payment.has_value());
+
+		const auto& upstream = upstreams[std::to_underlying(connection.gateway)];
+
+		connection.requestedAt = getCurrentDateTime();
+		connection.sentAt = std::chrono::steady_clock::now();
+
+		std::array<char, 256> json;
+		const auto jsonLength =
+			PaymentProcessor::formatPaymentRequest(json, connection.payment.value(), connection.requestedAt);
+
+		mg_printf(connection.conn,
+			"POST /payments HTTP/1.1\r\n"
+			"Host: %s\r\n"
+			"Content-Type: application/json\r\n"
+			"Content-Length: %d\r\n"
+			"\r\n",
+			upstream.host.c_str(), static_cast<int>(jsonLength));
+		mg_send(connection.conn, json.data(), jsonLength);
+	}
+
+	void AsyncPaymentProcessor::completePayment(UpstreamConnection& connection, int httpStatus)
+	{
+		if (!connection.payment.has_value())
+			return;
+
+		const auto payment = connection.payment.value();
+		const auto gateway = connection.gateway;
+
+		const bool failed = httpStatus >= 500 && httpStatus <= 599;
+		const auto latency = getElapsed(connection.sentAt);
+		const CircuitBreaker::Permit permit{.gateway = gateway, .probe = connection.probe};
+
+		connection.payment.reset();
+		--inFlightCount;
+		ConcurrencyLimiter::get(gateway).complete(latency, failed);
+
+		if (!connection.conn->is_closing)
+			upstreams[std::to_underlying(gateway)].idleConnections.push_back(&connection);
+
+		GatewayChooserService::reportPayment(gateway, latency, failed);
+		Tracing::record(Tracing::Stage::UPSTREAM_CALL, payment.correlationId, toSteadyNanos(connection.sentAt),
+			toSteadyNanos(connection.sentAt) + std::chrono::nanoseconds(latency).count(), gateway, httpStatus);
+
+		if (httpStatus == HTTP_STATUS_OK)
+		{
+			CircuitBreaker::release(permit, CircuitBreaker::Outcome::SUCCESS);
+			paymentService->postPayment(gateway, payment.amount, payment.correlationId, connection.requestedAt);
+		}
+		else if (failed)
+		{
+			CircuitBreaker::release(permit, CircuitBreaker::Outcome::FAILURE);
+			retryScheduler->schedule(payment);
+		}
+		else
+			CircuitBreaker::release(permit, CircuitBreaker::Outcome::NEUTRAL);
+	}
+
+	void AsyncPaymentProcessor::closeConnection(UpstreamConnection* connection)
+	{
+		auto& upstream = upstreams[std::to_underlying(connection->gateway)];
+
+		// A kept-alive connection closed by the processor before answering isn't an upstream failure:
+		// resend the payment through a new connection.
+		if (connection->payment.has_value() && connection->reused && !connection->responseStarted &&
+			!connection->timedOut)
+		{
+			CircuitBreaker::release(
+				CircuitBreaker::Permit{.gateway = connection->gateway, .probe = connection->probe},
+				CircuitBreaker::Outcome::NEUTRAL);
+			ConcurrencyLimiter::get(connection->gateway).release();
+
+			readyPayments.push_front(connection->payment.value());
+			connection->payment.reset();
+			--inFlightCount;
+		}
+
+		// Connection failure or timeout: retry the payment later, as the synchronous processor does.
+		if (connection->payment.has_value())
+		{
+			const auto latency = getElapsed(connection->connected ? connection->sentAt : connection->assignedAt);
+
+			GatewayChooserService::reportPayment(connection->gateway, latency, true);
+
+			if (Tracing::isEnabled())
+			{
+				const auto endNanos = getSteadyNanos();
+
+				Tracing::record(Tracing::Stage::UPSTREAM_CALL, connection->payment->correlationId,
+					endNanos - std::chrono::nanoseconds(latency).count(), endNanos, connection->gateway, -1);
+			}
+
+			CircuitBreaker::release(
+				CircuitBreaker::Permit{.gateway = connection->gateway, .probe = connection->probe},
+				CircuitBreaker::Outcome::FAILURE);
+
+			retryScheduler->schedule(connection->payment.value());
+			--inFlightCount;
+			ConcurrencyLimiter::get(connection->gateway).complete(latency, true);
+		}
+
+		// The address may have changed.
+		if (!connection->connected)
+			upstream.resolveNeeded = true;
+
+		std::erase(upstream.idleConnections, connection);
+		delete connection;
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "./Database.h"
+#include "./PaymentService.h"
+#include "./PendingPaymentsQueue.h"
+#include "./RetryScheduler.h"
+#include "./Util.h"
+#include <array>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "mongoose.h"
+
+
+namespace rinhaback::api
+{
+	// Sends payments to the processors through non-blocking keep-alive connections, so a single thread keeps
+	// as many payments in flight per gateway as its ConcurrencyLimiter allows.
+	class AsyncPaymentProcessor final
+	{
+	private:
+		struct UpstreamConnection
+		{
+			AsyncPaymentProcessor* processor;
+			PaymentGateway gateway;
+			bool probe = false;
+			mg_connection* conn = nullptr;
+			bool connected = false;
+			// Set when the payment went to an idle keep-alive connection, which the processor may have closed.
+			bool reused = false;
+			bool responseStarted = false;
+			bool timedOut = false;
+			std::optional<PendingPaymentsQueue::Payment> payment;
+			DateTimeMillis requestedAt;
+			std::chrono::steady_clock::time_point assignedAt;
+			std::chrono::steady_clock::time_point sentAt;
+		};
+
+		struct Upstream
+		{
+			std::string url;
+			std::string host;
+			std::string address;
+			std::chrono::steady_clock::time_point resolvedAt;
+			bool resolveNeeded = true;
+			std::vector<UpstreamConnection*> idleConnections;
+		};
+
+	public:
+		AsyncPaymentProcessor() = default;
+
+		AsyncPaymentProcessor(const AsyncPaymentProcessor&) = delete;
+		AsyncPaymentProcessor& operator=(const AsyncPaymentProcessor&) = delete;
+
+	public:
+		static std::jthread start(std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue,
+			std::shared_ptr<RetryScheduler> retryScheduler, std::shared_ptr<PaymentService> paymentService);
+
+	private:
+		static void eventHandler(mg_connection* conn, int ev, void* evData);
+
+		void handler();
+		void resolveUpstream(Upstream& upstream);
+		void dispatch();
+		void sendPayment(UpstreamConnection& connection);
+		void completePayment(UpstreamConnection& connection, int httpStatus);
+		void closeConnection(UpstreamConnection* connection);
+
+	private:
+		static inline constexpr int POLL_TIME = 1;
+		static inline constexpr std::chrono::seconds RESOLVE_INTERVAL{1};
+		static inline constexpr unsigned DEQUEUE_BATCH_SIZE = 32;
+
+	private:
+		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
+		std::shared_ptr<RetryScheduler> retryScheduler;
+		std::shared_ptr<PaymentService> paymentService;
+		mg_mgr mgr;
+		std::array<Upstream, std::to_underlying(PaymentGateway::SIZE)> upstreams;
+		std::deque<PendingPaymentsQueue::Payment> readyPayments;
+		unsigned inFlightCount = 0;
+	};
+}  // namespace rinhaback::api
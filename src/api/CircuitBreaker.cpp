@@ -0,0 +1,145 @@
+#include "./CircuitBreaker.h"
+#include "./Config.h"
+#include "./SharedMemory.h"
+#include "./Util.h"
+#include <chrono>
+#include <print>
+#include <utility>
+
+
+namespace rinhaback::api
+{
+	static SharedData::CircuitBreakerData& getData(PaymentGateway gateway)
+	{
+		return getSharedData().circuitBreakers[std::to_underlying(gateway)];
+	}
+
+	static std::int64_t toNanos(std::chrono::nanoseconds duration)
+	{
+		return duration.count();
+	}
+
+	std::optional<CircuitBreaker::Permit> CircuitBreaker::acquire(PaymentGateway preferred)
+	{
+		if (const auto permit = tryAcquire(preferred))
+			return permit;
+
+		return tryAcquire(preferred == PaymentGateway::DEFAULT ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT);
+	}
+
+	std::optional<CircuitBreaker::Permit> CircuitBreaker::tryAcquire(PaymentGateway gateway)
+	{
+		auto& data = getData(gateway);
+		auto stateWord = data.stateWord.load();
+
+		if (decodeState(stateWord) == State::CLOSED)
+			return Permit{.gateway = gateway, .probe = false};
+
+		const auto now = getSteadyNanos();
+
+		if (decodeState(stateWord) == State::OPEN)
+		{
+			if (now - decodeChangedAt(stateWord) < toNanos(Config::breakerOpenTime))
+				return std::nullopt;
+
+			transition(gateway, stateWord, State::HALF_OPEN);
+			stateWord = data.stateWord.load();
+
+			if (decodeState(stateWord) == State::CLOSED)
+				return Permit{.gateway = gateway, .probe = false};
+			else if (decodeState(stateWord) == State::OPEN)
+				return std::nullopt;
+		}
+
+		// Probes of an instance that died never come back, so give the half-open state a fresh start once
+		// they would have timed out.
+		if (now - decodeChangedAt(stateWord) > toNanos(Config::processorTimeout) &&
+			transition(gateway, stateWord, State::HALF_OPEN))
+		{
+			data.probesInFlight.store(0);
+		}
+
+		if (data.probesInFlight.fetch_add(1) < Config::breakerHalfOpenProbes)
+			return Permit{.gateway = gateway, .probe = true};
+
+		data.probesInFlight.fetch_sub(1);
+		return std::nullopt;
+	}
+
+	void CircuitBreaker::release(const Permit& permit, Outcome outcome)
+	{
+		auto& data = getData(permit.gateway);
+
+		// Don't underflow the counter reset when restarting a stuck half-open state.
+		if (permit.probe)
+		{
+			auto probesInFlight = data.probesInFlight.load();
+
+			while (probesInFlight > 0 && !data.probesInFlight.compare_exchange_weak(probesInFlight, probesInFlight - 1))
+			{
+			}
+		}
+
+		const auto stateWord = data.stateWord.load();
+
+		switch (outcome)
+		{
+			case Outcome::SUCCESS:
+				data.consecutiveFailures.store(0);
+
+				if (permit.probe && decodeState(stateWord) == State::HALF_OPEN &&
+					data.probeSuccesses.fetch_add(1) + 1 >= Config::breakerHalfOpenProbes)
+				{
+					transition(permit.gateway, stateWord, State::CLOSED);
+				}
+
+				break;
+
+			case Outcome::FAILURE:
+				if (permit.probe)
+				{
+					if (decodeState(stateWord) == State::HALF_OPEN)
+						transition(permit.gateway, stateWord, State::OPEN);
+				}
+				else if (data.consecutiveFailures.fetch_add(1) + 1 >= Config::breakerFailureThreshold &&
+					decodeState(stateWord) == State::CLOSED)
+				{
+					transition(permit.gateway, stateWord, State::OPEN);
+				}
+
+				break;
+
+			case Outcome::NEUTRAL:
+				break;
+		}
+	}
+
+	CircuitBreaker::State CircuitBreaker::getState(PaymentGateway gateway)
+	{
+		return decodeState(getData(gateway).stateWord.load());
+	}
+
+	bool CircuitBreaker::transition(PaymentGateway gateway, std::uint64_t fromWord, State to)
+	{
+		static constexpr const char* STATE_NAMES[] = {"CLOSED", "OPEN", "HALF_OPEN"};
+
+		auto& data = getData(gateway);
+		const auto toWord = static_cast<std::uint64_t>(getSteadyNanos()) << 2 | std::to_underlying(to);
+
+		if (!data.stateWord.compare_exchange_strong(fromWord, toWord))
+			return false;
+
+		data.consecutiveFailures.store(0);
+		data.probeSuccesses.store(0);
+
+		const auto from = decodeState(fromWord);
+
+		if (from != to)
+		{
+			std::println("{} circuit breaker: {} -> {}", gateway == PaymentGateway::DEFAULT ? "DEFAULT" : "FALLBACK",
+				STATE_NAMES[std::to_underlying(from)], STATE_NAMES[std::to_underlying(to)]);
+		}
+
+		return true;
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "./Database.h"
+#include <cstdint>
+#include <optional>
+
+
+namespace rinhaback::api
+{
+	// Per-gateway circuit breaker, shared by all the instances.
+	// CLOSED: payments flow; BREAKER_FAILURE_THRESHOLD consecutive failures open it.
+	// OPEN: payments are refused for BREAKER_OPEN_TIME, then it becomes HALF_OPEN.
+	// HALF_OPEN: up to BREAKER_HALF_OPEN_PROBES payments at a time probe the gateway. The same number of
+	// successful probes closes it, and a failed probe opens it again.
+	class CircuitBreaker final
+	{
+	public:
+		enum class State : std::uint8_t
+		{
+			CLOSED = 0,
+			OPEN = 1,
+			HALF_OPEN = 2
+		};
+
+		enum class Outcome
+		{
+			SUCCESS,
+			FAILURE,
+			// Neither tells about the gateway health nor consumes a probe (e.g. rejected payments).
+			NEUTRAL
+		};
+
+		struct Permit
+		{
+			PaymentGateway gateway;
+			bool probe;
+		};
+
+	public:
+		CircuitBreaker() = delete;
+
+	public:
+		// Tries the preferred gateway and then the other one. Returns nullopt when both refuse payments.
+		static std::optional<Permit> acquire(PaymentGateway preferred);
+
+		static std::optional<Permit> tryAcquire(PaymentGateway gateway);
+		static void release(const Permit& permit, Outcome outcome);
+
+		static State getState(PaymentGateway gateway);
+
+	private:
+		static State decodeState(std::uint64_t stateWord)
+		{
+			return static_cast<State>(stateWord & 3);
+		}
+
+		static std::int64_t decodeChangedAt(std::uint64_t stateWord)
+		{
+			return static_cast<std::int64_t>(stateWord >> 2);
+		}
+
+		static bool transition(PaymentGateway gateway, std::uint64_t fromWord, State to);
+	};
+}  // namespace rinhaback::api
@@ -0,0 +1,97 @@
+#include "./ConcurrencyLimiter.h"
+#include "./Config.h"
+#include <algorithm>
+#include <cassert>
+
+
+namespace rinhaback::api
+{
+	ConcurrencyLimiter::ConcurrencyLimiter()
+		: limit(std::clamp(static_cast<double>(Config::processorInitialInFlight),
+			  static_cast<double>(Config::processorMinInFlight), static_cast<double>(Config::processorMaxInFlight)))
+	{
+	}
+
+	ConcurrencyLimiter& ConcurrencyLimiter::get(PaymentGateway gateway)
+	{
+		static ConcurrencyLimiter defaultLimiter;
+		static ConcurrencyLimiter fallbackLimiter;
+
+		switch (gateway)
+		{
+			case PaymentGateway::DEFAULT:
+				return defaultLimiter;
+
+			case PaymentGateway::FALLBACK:
+				return fallbackLimiter;
+
+			default:
+				assert(false);
+				return defaultLimiter;
+		}
+	}
+
+	bool ConcurrencyLimiter::acquire(std::chrono::milliseconds timeout)
+	{
+		if (tryAcquire())
+			return true;
+
+		std::unique_lock lock(mutex);
+		waiters.fetch_add(1);
+
+		const bool acquired = condVar.wait_for(lock, timeout, [this] { return tryAcquire(); });
+
+		waiters.fetch_sub(1);
+
+		return acquired;
+	}
+
+	void ConcurrencyLimiter::release()
+	{
+		// seq_cst pairs with the increment of waiters in acquire, so a waiter is either seen or sees the slot.
+		inFlight.fetch_sub(1);
+		notifyWaiters(false);
+	}
+
+	void ConcurrencyLimiter::complete(std::chrono::microseconds latency, bool failed)
+	{
+		const auto micros = static_cast<double>(latency.count());
+		auto baseline = baselineLatencyMicros.load(std::memory_order_relaxed);
+
+		while (!baselineLatencyMicros.compare_exchange_weak(baseline,
+			baseline == 0 ? micros : baseline + BASELINE_ALPHA * (micros - baseline), std::memory_order_relaxed))
+		{
+		}
+
+		const bool dropped = failed || (baseline != 0 && micros > baseline * LATENCY_TOLERANCE);
+		const auto usedSlots = inFlight.load(std::memory_order_relaxed);
+		auto currentLimit = limit.load(std::memory_order_relaxed);
+		double newLimit;
+
+		do
+		{
+			if (dropped)
+				newLimit = std::max(currentLimit * BACKOFF_RATIO, static_cast<double>(Config::processorMinInFlight));
+			else if (usedSlots * 2 >= currentLimit)
+				newLimit = std::min(currentLimit + 1, static_cast<double>(Config::processorMaxInFlight));
+			else
+				break;
+		} while (!limit.compare_exchange_weak(currentLimit, newLimit, std::memory_order_relaxed));
+
+		inFlight.fetch_sub(1);
+		notifyWaiters(!dropped);
+	}
+
+	void ConcurrencyLimiter::notifyWaiters(bool all)
+	{
+		if (waiters.load() == 0)
+			return;
+
+		std::unique_lock lock(mutex);
+
+		if (all)
+			condVar.notify_all();
+		else
+			condVar.notify_one();
+	}
+}  // namespace rinhaback::api
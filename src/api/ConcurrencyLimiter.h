@@ -0,0 +1,74 @@
+#pragma once
+
+#include "./Database.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+
+namespace rinhaback::api
+{
+	// AIMD limit of the in-flight payments to a gateway, in the style of Netflix's concurrency-limits.
+	// The limit grows by one for each payment completed while at least half of it was in use, and is multiplied by
+	// BACKOFF_RATIO on each failure or on a response much slower than the usual latency.
+	class ConcurrencyLimiter final
+	{
+	public:
+		ConcurrencyLimiter();
+
+		ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+		ConcurrencyLimiter& operator=(const ConcurrencyLimiter&) = delete;
+
+	public:
+		static ConcurrencyLimiter& get(PaymentGateway gateway);
+
+		bool tryAcquire()
+		{
+			const auto limit = static_cast<unsigned>(this->limit.load(std::memory_order_relaxed));
+
+			if (inFlight.fetch_add(1, std::memory_order_relaxed) >= limit)
+			{
+				inFlight.fetch_sub(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			return true;
+		}
+
+		// Waits up to the timeout for the limit to allow another payment.
+		bool acquire(std::chrono::milliseconds timeout);
+
+		// Gives back a slot which wasn't used for a payment call.
+		void release();
+
+		// Gives back a slot, adjusting the limit from the call outcome.
+		void complete(std::chrono::microseconds latency, bool failed);
+
+		unsigned getLimit() const
+		{
+			return static_cast<unsigned>(limit.load(std::memory_order_relaxed));
+		}
+
+		unsigned getInFlight() const
+		{
+			return inFlight.load(std::memory_order_relaxed);
+		}
+
+	private:
+		void notifyWaiters(bool all);
+
+	private:
+		static inline constexpr double BACKOFF_RATIO = 0.9;
+		static inline constexpr double BASELINE_ALPHA = 0.01;
+		static inline constexpr double LATENCY_TOLERANCE = 2.0;
+
+	private:
+		std::atomic<double> limit;
+		std::atomic_uint inFlight{0};
+		std::atomic<double> baselineLatencyMicros{0};
+		std::mutex mutex;
+		std::condition_variable condVar;
+		std::atomic_uint waiters{0};
+	};
+}  // namespace rinhaback::api
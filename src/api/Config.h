@@ -1,6 +1,9 @@
 #pragma once
 
+#include <chrono>
 #include <string>
+#include <vector>
+#include <cstddef>
 #include <cstdlib>
 
 
@@ -15,17 +18,98 @@ namespace rinhaback::api
 			return val ? val : defaultVal;
 		}
 
+		// Parses lists like "0,2,4-7".
+		static std::vector<unsigned> readCpuList(const char* name)
+		{
+			const auto list = readEnv(name, "");
+			std::vector<unsigned> cpus;
+			std::size_t start = 0;
+
+			while (start < list.size())
+			{
+				auto end = list.find(',', start);
+
+				if (end == std::string::npos)
+					end = list.size();
+
+				const auto item = list.substr(start, end - start);
+
+				if (const auto dash = item.find('-'); dash != std::string::npos)
+				{
+					const auto first = (unsigned) std::stoi(item.substr(0, dash));
+					const auto last = (unsigned) std::stoi(item.substr(dash + 1));
+
+					for (auto cpu = first; cpu <= last; ++cpu)
+						cpus.push_back(cpu);
+				}
+				else if (!item.empty())
+					cpus.push_back((unsigned) std::stoi(item));
+
+				start = end + 1;
+			}
+
+			return cpus;
+		}
+
 	public:
 		Config() = delete;
 
 	public:
 		static inline const auto serverWorkers = (unsigned) std::stoi(readEnv("SERVER_WORKERS", "1"));
 		static inline const auto serverPollTime = (unsigned) std::stoi(readEnv("SERVER_POLL_TIME", "1"));
+		static inline const auto serverCpus = readCpuList("SERVER_CPUS");
+		static inline const auto summaryWorkers = (unsigned) std::stoi(readEnv("SUMMARY_WORKERS", "1"));
 		static inline const auto processorWorkers = (unsigned) std::stoi(readEnv("PROCESSOR_WORKERS", "1"));
+		static inline const auto processorCpus = readCpuList("PROCESSOR_CPUS");
+		static inline const auto processorAsync = readEnv("PROCESSOR_MODE", "sync") == "async";
+		static inline const auto processorMaxInFlight =
+			(unsigned) std::stoi(readEnv("PROCESSOR_MAX_IN_FLIGHT", "256"));
+		static inline const auto processorMinInFlight =
+			(unsigned) std::stoi(readEnv("PROCESSOR_MIN_IN_FLIGHT", "1"));
+		static inline const auto processorInitialInFlight =
+			(unsigned) std::stoi(readEnv("PROCESSOR_INITIAL_IN_FLIGHT", "32"));
+		static inline const auto processorTimeout =
+			std::chrono::milliseconds(std::stoi(readEnv("PROCESSOR_TIMEOUT", "5000")));
+		static inline const auto processorPoolSize =
+			(unsigned) std::stoi(readEnv("PROCESSOR_POOL_SIZE", std::to_string(processorWorkers).c_str()));
+		static inline const auto processorPoolIdleTimeout =
+			std::chrono::milliseconds(std::stoi(readEnv("PROCESSOR_POOL_IDLE_TIMEOUT", "4000")));
+		static inline const auto breakerFailureThreshold =
+			(unsigned) std::stoi(readEnv("BREAKER_FAILURE_THRESHOLD", "5"));
+		static inline const auto breakerOpenTime =
+			std::chrono::milliseconds(std::stoi(readEnv("BREAKER_OPEN_TIME", "500")));
+		static inline const auto breakerHalfOpenProbes =
+			(unsigned) std::stoi(readEnv("BREAKER_HALF_OPEN_PROBES", "2"));
+		static inline const auto retryBaseDelay =
+			std::chrono::milliseconds(std::stoi(readEnv("RETRY_BASE_DELAY", "5")));
+		static inline const auto retryMaxDelay =
+			std::chrono::milliseconds(std::stoi(readEnv("RETRY_MAX_DELAY", "500")));
+		static inline const auto pendingQueueCapacity =
+			(unsigned) std::stoi(readEnv("PENDING_QUEUE_CAPACITY", "65536"));
+		static inline const auto sharedPendingQueue = readEnv("SHARED_PENDING_QUEUE", "false") == "true";
 		static inline const auto database = readEnv("DATABASE", "/data/database");
-		static inline const auto databaseSize = (unsigned) std::stoi(readEnv("DATABASE_SIZE", "10485760"));
+		// Initial map size, grown as needed up to DATABASE_MAX_SIZE.
+		static inline const auto databaseSize = (std::size_t) std::stoull(readEnv("DATABASE_SIZE", "10485760"));
+		static inline const auto databaseMaxSize =
+			(std::size_t) std::stoull(readEnv("DATABASE_MAX_SIZE", "17179869184"));
 		static inline const auto databaseInit = readEnv("DATABASE_INIT", "false") == "true";
+		static inline const auto instanceId = (unsigned) std::stoi(readEnv("INSTANCE_ID", databaseInit ? "0" : "1"));
+		static inline const auto commitBatchSize = (unsigned) std::stoi(readEnv("COMMIT_BATCH_SIZE", "64"));
+		static inline const auto commitMaxWait =
+			std::chrono::microseconds(std::stoi(readEnv("COMMIT_MAX_WAIT_US", "2000")));
+		static inline const auto paymentMirror = readEnv("PAYMENT_MIRROR", "false") == "true";
+		static inline const auto paymentMirrorCapacity =
+			(unsigned) std::stoi(readEnv("PAYMENT_MIRROR_CAPACITY", "262144"));
+		static inline const auto tracing = readEnv("TRACING", "false") == "true";
+		static inline const auto tracingBufferSize = (unsigned) std::stoi(readEnv("TRACING_BUFFER_SIZE", "16384"));
+		// Path of a TrafficLog of the received requests, empty to not record.
+		static inline const auto trafficRecord = readEnv("TRAFFIC_RECORD", "");
+		// Prefix of the names of the shared memory segments, which only the instances of a deployment may share.
+		static inline const auto sharedMemoryPrefix =
+			readEnv("SHARED_MEMORY_PREFIX", "rinhaback25-haproxy-mongoose-lmdb");
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:8080");
+		static inline const auto listenReusePort = readEnv("LISTEN_REUSE_PORT", "true") == "true";
+		static inline const auto listenCpuSteering = readEnv("LISTEN_CPU_STEERING", "false") == "true";
 		static inline const auto processorDefaultUrl =
 			readEnv("PROCESSOR_DEFAULT_URL", "http://payment-processor-default:8080");
 		static inline const auto processorFallbackUrl =
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <format>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+
+namespace rinhaback::api
+{
+	class CpuAffinity final
+	{
+	public:
+		CpuAffinity() = delete;
+
+	public:
+		// Pins the thread to cpus[index % cpus.size()]. Does nothing when no CPUs are configured.
+		static void pin(std::jthread& thread, const std::vector<unsigned>& cpus, unsigned index)
+		{
+			if (cpus.empty())
+				return;
+
+			const auto cpu = cpus[index % cpus.size()];
+
+			cpu_set_t cpuSet;
+			CPU_ZERO(&cpuSet);
+			CPU_SET(cpu, &cpuSet);
+
+			if (const auto error = pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet))
+				throw std::runtime_error(std::format("Cannot pin thread to CPU {}: {}", cpu, std::strerror(error)));
+		}
+	};
+}  // namespace rinhaback::api
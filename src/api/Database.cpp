@@ -1,8 +1,12 @@
 #include "./Database.h"
 #include "./Config.h"
 #include "./Util.h"
+#include <algorithm>
 #include <bit>
 #include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <string_view>
 #include <thread>
 #include <cstring>
 
@@ -13,28 +17,38 @@ namespace rinhaback::api
 {
 	Connection::Connection()
 	{
-		if (Config::databaseInit)
+		if (!Config::databaseInit)
+			std::this_thread::sleep_for(std::chrono::seconds(2));  // FIXME:
+
+		open(Config::database, Config::databaseSize, Config::databaseInit);
+	}
+
+	Connection::Connection(const std::string& path, std::size_t size, bool create)
+	{
+		open(path, size, create);
+	}
+
+	void Connection::open(const std::string& path, std::size_t size, bool create)
+	{
+		if (create)
 		{
-			if (stdfs::exists(Config::database))
+			if (stdfs::exists(path))
 			{
-				stdfs::remove(stdfs::path(Config::database).append("data.mdb"));
-				stdfs::remove(stdfs::path(Config::database).append("lock.mdb"));
+				stdfs::remove(stdfs::path(path).append("data.mdb"));
+				stdfs::remove(stdfs::path(path).append("lock.mdb"));
 			}
 			else
-				stdfs::create_directories(Config::database);
+				stdfs::create_directories(path);
 		}
-		else
-			std::this_thread::sleep_for(std::chrono::seconds(2));  // FIXME:
 
 		const int endiannessFlags = std::endian::native == std::endian::little ? (MDB_REVERSEKEY | MDB_REVERSEDUP) : 0;
+		const int bucketFlags = MDB_CREATE | (endiannessFlags & MDB_REVERSEKEY);
 
 		checkMdbError(mdb_env_create(&env));
-		checkMdbError(mdb_env_set_mapsize(env, Config::databaseSize));
-		checkMdbError(mdb_env_set_maxdbs(env, std::to_underlying(PaymentGateway::SIZE)));
-		checkMdbError(mdb_env_open(env, Config::database.c_str(),
-			MDB_WRITEMAP | MDB_NOMETASYNC | MDB_NOSYNC | MDB_NOTLS | MDB_NOMEMINIT |
-				(Config::databaseInit ? MDB_CREATE : 0),
-			0664));
+		checkMdbError(mdb_env_set_mapsize(env, size));
+		checkMdbError(mdb_env_set_maxdbs(env, std::to_underlying(PaymentGateway::SIZE) * 3 + 1));
+		checkMdbError(mdb_env_open(env, path.c_str(),
+			MDB_WRITEMAP | MDB_NOMETASYNC | MDB_NOSYNC | MDB_NOTLS | MDB_NOMEMINIT | (create ? MDB_CREATE : 0), 0664));
 
 		Transaction transaction(*this, 0);
 
@@ -45,6 +59,134 @@ namespace rinhaback::api
 		checkMdbError(
 			mdb_dbi_open(transaction.txn, "fallback", MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | endiannessFlags,
 				&dbis[std::to_underlying(PaymentGateway::FALLBACK)]));
+
+		checkMdbError(mdb_dbi_open(transaction.txn, "default-buckets", bucketFlags,
+			&bucketDbis[std::to_underlying(PaymentGateway::DEFAULT)]));
+
+		checkMdbError(mdb_dbi_open(transaction.txn, "fallback-buckets", bucketFlags,
+			&bucketDbis[std::to_underlying(PaymentGateway::FALLBACK)]));
+
+		checkMdbError(mdb_dbi_open(
+			transaction.txn, "default-ids", MDB_CREATE, &idDbis[std::to_underlying(PaymentGateway::DEFAULT)]));
+
+		checkMdbError(mdb_dbi_open(
+			transaction.txn, "fallback-ids", MDB_CREATE, &idDbis[std::to_underlying(PaymentGateway::FALLBACK)]));
+
+		checkMdbError(mdb_dbi_open(transaction.txn, "meta", MDB_CREATE, &metaDbi));
+
+		checkVersion(transaction.txn);
+	}
+
+	void Connection::checkVersion(MDB_txn* txn)
+	{
+		static constexpr std::string_view VERSION_KEY = "version";
+
+		MDB_val mdbKey(VERSION_KEY.size(), const_cast<char*>(VERSION_KEY.data()));
+		MDB_val mdbData;
+
+		const int rc = mdb_get(txn, metaDbi, &mdbKey, &mdbData);
+
+		if (rc == 0)
+		{
+			std::uint32_t version = 0;
+
+			if (mdbData.mv_size == sizeof(version))
+				std::memcpy(&version, mdbData.mv_data, sizeof(version));
+
+			if (version != STORAGE_VERSION)
+			{
+				throw std::runtime_error(
+					std::format("Unsupported database version {} (expected {})", version, STORAGE_VERSION));
+			}
+
+			return;
+		}
+
+		if (rc != MDB_NOTFOUND)
+			checkMdbError(rc);
+
+		// Only a new database may be stamped. Payments without a version are of the initial layout.
+		for (const auto dbi : dbis)
+		{
+			MDB_stat stat;
+			checkMdbError(mdb_stat(txn, dbi, &stat));
+
+			if (stat.ms_entries != 0)
+				throw std::runtime_error("Unsupported database version 1, recreate it with DATABASE_INIT");
+		}
+
+		auto version = STORAGE_VERSION;
+		mdbData = MDB_val(sizeof(version), &version);
+		checkMdbError(mdb_put(txn, metaDbi, &mdbKey, &mdbData, 0));
+	}
+
+	std::size_t Connection::getMapSize()
+	{
+		MDB_envinfo info;
+		checkMdbError(mdb_env_info(env, &info));
+
+		return info.me_mapsize;
+	}
+
+	bool Connection::growMap(std::size_t observedSize)
+	{
+		std::unique_lock lock(resizeMutex);
+
+		// Grown meanwhile by another thread.
+		if (getMapSize() > observedSize)
+			return true;
+
+		const auto newSize = std::min(observedSize * DATABASE_GROWTH_FACTOR, Config::databaseMaxSize);
+
+		if (newSize <= observedSize)
+			return false;
+
+		// Other processes adopt it when their next transaction begins, after ours commits it.
+		checkMdbError(mdb_env_set_mapsize(env, newSize));
+
+		std::println("Database map grown to {} bytes.", newSize);
+
+		return true;
+	}
+
+	void Connection::adoptMapSize()
+	{
+		std::unique_lock lock(resizeMutex);
+
+		checkMdbError(mdb_env_set_mapsize(env, 0));
+	}
+
+	void writeTransaction(Connection& connection, const std::function<void(Transaction&)>& body)
+	{
+		while (true)
+		{
+			std::size_t mapSize = 0;
+
+			try
+			{
+				Transaction transaction(connection, 0);
+				mapSize = connection.getMapSize();
+
+				try
+				{
+					body(transaction);
+				}
+				catch (...)
+				{
+					transaction.abort();
+					throw;
+				}
+
+				transaction.commit();
+
+				return;
+			}
+			catch (const MdbError& e)
+			{
+				if (e.code != MDB_MAP_FULL || !connection.growMap(mapSize))
+					throw;
+			}
+		}
 	}
 
 	Connection::~Connection()
@@ -55,6 +197,21 @@ namespace rinhaback::api
 				mdb_dbi_close(env, dbi);
 		}
 
+		for (auto dbi : bucketDbis)
+		{
+			if (dbi)
+				mdb_dbi_close(env, dbi);
+		}
+
+		for (auto dbi : idDbis)
+		{
+			if (dbi)
+				mdb_dbi_close(env, dbi);
+		}
+
+		if (metaDbi)
+			mdb_dbi_close(env, metaDbi);
+
 		mdb_env_close(env);
 	}
 }  // namespace rinhaback::api
@@ -2,8 +2,14 @@
 
 #include <array>
 #include <format>
+#include <functional>
+#include <mutex>
 #include <print>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
 #include <utility>
+#include <cstddef>
 #include <cstdint>
 #include "lmdb.h"
 
@@ -23,6 +29,19 @@ namespace rinhaback::api
 
 	using CorrelationId = std::array<char, 36>;
 
+	class MdbError final : public std::runtime_error
+	{
+	public:
+		explicit MdbError(int code, const std::string& message)
+			: std::runtime_error(message),
+			  code(code)
+		{
+		}
+
+	public:
+		const int code;
+	};
+
 	inline void checkMdbError(int rc
 #ifndef NDEBUG
 		,
@@ -39,22 +58,55 @@ namespace rinhaback::api
 				std::format("MDB error: {}", rc);
 #endif
 			std::println(stderr, "{}", msg);
-			throw std::runtime_error(msg);
+			throw MdbError(rc, msg);
 		}
 	}
 
 	class Connection final
 	{
 	public:
+		// Opens the database configured by DATABASE, DATABASE_SIZE and DATABASE_INIT.
 		explicit Connection();
+
+		// Opens the database in path. With create, its files are removed first and it's recreated empty.
+		explicit Connection(const std::string& path, std::size_t size, bool create);
+
 		~Connection();
 
 		Connection(const Connection&) = delete;
 		Connection& operator=(const Connection&) = delete;
 
+	public:
+		std::size_t getMapSize();
+
+		// Grows the map geometrically up to DATABASE_MAX_SIZE, unless it has grown since observedSize was read.
+		// Must be called without transactions of this thread. Returns false when the map cannot grow further.
+		bool growMap(std::size_t observedSize);
+
+		// Adopts the map size grown by another process. Must be called without transactions of this thread.
+		void adoptMapSize();
+
+	private:
+		void open(const std::string& path, std::size_t size, bool create);
+		void checkVersion(MDB_txn* txn);
+
+	public:
+		// Layout of the records (see PaymentRepository), stored in the meta DBI. Databases of other versions are
+		// refused, as DATABASE_INIT recreates them anyway.
+		static inline constexpr std::uint32_t STORAGE_VERSION = 2;
+
+	private:
+		static inline constexpr std::size_t DATABASE_GROWTH_FACTOR = 2;
+
 	public:
 		MDB_env* env;
 		std::array<MDB_dbi, std::to_underlying(PaymentGateway::SIZE)> dbis;
+		std::array<MDB_dbi, std::to_underlying(PaymentGateway::SIZE)> bucketDbis;
+		std::array<MDB_dbi, std::to_underlying(PaymentGateway::SIZE)> idDbis;
+		MDB_dbi metaDbi;
+
+		// Transactions hold it shared, as LMDB can only change the map size without transactions in the process.
+		std::shared_mutex resizeMutex;
 	};
 
 	class Transaction final
@@ -62,13 +114,27 @@ namespace rinhaback::api
 	public:
 		explicit Transaction(Connection& connection, int flags)
 			: connection(connection),
-			  flags(flags)
+			  flags(flags),
+			  resizeLock(connection.resizeMutex)
 		{
-			checkMdbError(mdb_txn_begin(connection.env, nullptr, flags, &txn));
+			int rc;
+
+			// Another process has grown the map.
+			while ((rc = mdb_txn_begin(connection.env, nullptr, flags, &txn)) == MDB_MAP_RESIZED)
+			{
+				resizeLock.unlock();
+				connection.adoptMapSize();
+				resizeLock.lock();
+			}
+
+			checkMdbError(rc);
 		}
 
 		~Transaction()
 		{
+			if (!txn)
+				return;
+
 			if (flags & MDB_RDONLY)
 				mdb_txn_abort(txn);
 			else
@@ -78,12 +144,35 @@ namespace rinhaback::api
 		Transaction(const Transaction&) = delete;
 		Transaction& operator=(const Transaction&) = delete;
 
+	public:
+		// Commits now, reporting errors the destructor would ignore.
+		void commit()
+		{
+			const int rc = mdb_txn_commit(txn);
+			txn = nullptr;
+			checkMdbError(rc);
+		}
+
+		void abort()
+		{
+			mdb_txn_abort(txn);
+			txn = nullptr;
+		}
+
 	public:
 		Connection& connection;
-		MDB_txn* txn;
+		MDB_txn* txn = nullptr;
 		const int flags;
+
+	private:
+		std::shared_lock<std::shared_mutex> resizeLock;
 	};
 
+	// Runs body in a write transaction and commits it, or nothing when it throws. When the map is full, it's grown
+	// and body runs again in a new transaction, so body must not have effects outside of it other than the ones it
+	// redoes.
+	void writeTransaction(Connection& connection, const std::function<void(Transaction&)>& body);
+
 	inline Connection& getConnection()
 	{
 		static Connection connection;
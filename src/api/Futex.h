@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace rinhaback::api
+{
+	class Futex final
+	{
+	public:
+		Futex() = delete;
+
+	public:
+		// Sleeps while word == expected, up to timeout. Spurious wakeups are possible.
+		static void wait(std::atomic_uint32_t& word, std::uint32_t expected, std::chrono::nanoseconds timeout,
+			bool shared = false)
+		{
+			const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+			const timespec ts{
+				.tv_sec = static_cast<time_t>(seconds.count()),
+				.tv_nsec = static_cast<long>((timeout - seconds).count()),
+			};
+
+			syscall(SYS_futex, address(word), shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+		}
+
+		static void wake(std::atomic_uint32_t& word, int count, bool shared = false)
+		{
+			syscall(SYS_futex, address(word), shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+		}
+
+	private:
+		static std::uint32_t* address(std::atomic_uint32_t& word)
+		{
+			static_assert(sizeof(std::atomic_uint32_t) == sizeof(std::uint32_t));
+			static_assert(std::atomic_uint32_t::is_always_lock_free);
+
+			return reinterpret_cast<std::uint32_t*>(&word);
+		}
+	};
+}  // namespace rinhaback::api
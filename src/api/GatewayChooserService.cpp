@@ -1,70 +1,31 @@
 #include "./GatewayChooserService.h"
+#include "./CircuitBreaker.h"
+#include "./ConcurrencyLimiter.h"
 #include "./Config.h"
+#include "./GatewayStats.h"
+#include "./Metrics.h"
+#include "./SharedMemory.h"
 #include "./SignalHandling.h"
+#include "./Util.h"
 #include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <functional>
+#include <future>
 #include <optional>
 #include <print>
 #include <string_view>
 #include <utility>
 #include <cassert>
 #include <experimental/scope>
-#include "boost/interprocess/shared_memory_object.hpp"
-#include "boost/interprocess/mapped_region.hpp"
 #include "httplib.h"
 #include "yyjson.h"
 
 
 namespace rinhaback::api
 {
-	namespace boostipc = boost::interprocess;
-
 	namespace
 	{
-		struct SharedData
-		{
-			std::atomic_uint8_t currentGateway{static_cast<std::uint8_t>(PaymentGateway::DEFAULT)};
-		};
-
-		class SharedMemoryManager
-		{
-		private:
-			static inline constexpr const char* SHARED_MEMORY_NAME =
-				"rinhaback25-haproxy-mongoose-lmdb-GatewayChooserService";
-
-		public:
-			SharedMemoryManager(bool isCreator = false)
-			{
-				if (isCreator)
-				{
-					boostipc::shared_memory_object::remove(SHARED_MEMORY_NAME);
-					shm =
-						boostipc::shared_memory_object(boostipc::create_only, SHARED_MEMORY_NAME, boostipc::read_write);
-
-					shm.truncate(sizeof(SharedData));
-
-					region = boostipc::mapped_region(shm, boostipc::read_write);
-					void* addr = region.get_address();
-					data = new (addr) SharedData;
-				}
-				else
-				{
-					std::this_thread::sleep_for(std::chrono::seconds(2));  // FIXME:
-
-					shm = boostipc::shared_memory_object(boostipc::open_only, SHARED_MEMORY_NAME, boostipc::read_write);
-					region = boostipc::mapped_region(shm, boostipc::read_write);
-					data = static_cast<SharedData*>(region.get_address());
-				}
-			}
-
-		public:
-			SharedData* data;
-
-		private:
-			boostipc::shared_memory_object shm;
-			boostipc::mapped_region region;
-		};
-
 		struct GatewayHealthResponse
 		{
 			bool failing;
@@ -72,11 +33,12 @@ namespace rinhaback::api
 		};
 	}  // namespace
 
-	static SharedMemoryManager sharedMemoryManager{Config::databaseInit};
-
-	static std::optional<GatewayHealthResponse> getGatewayHealth(const std::string& url)
+	static std::optional<GatewayHealthResponse> getGatewayHealth(const std::string& url, std::chrono::seconds timeout)
 	{
 		httplib::Client client(url);
+		client.set_connection_timeout(timeout);
+		client.set_read_timeout(timeout);
+
 		const auto response = client.Get("/payments/service-health");
 
 		if (response && response->status == 200)
@@ -104,122 +66,205 @@ namespace rinhaback::api
 
 	std::jthread GatewayChooserService::start()
 	{
-		if (!Config::databaseInit)
-			return {};
-		else
-			return std::jthread(handler);
+		return std::jthread(handler);
 	}
 
+	// Runs in all the instances, but only the one holding the lease polls the processors. If it dies, another takes
+	// over when the lease expires.
 	void GatewayChooserService::handler()
 	{
 		std::println("GatewayChooserService started.");
 
-		auto lastDefaultCheck = std::chrono::steady_clock::now() - POLL_TIME;
-		auto lastFallbackCheck = std::chrono::steady_clock::now() - POLL_TIME;
-
-		std::optional<GatewayHealthResponse> defaultHealth;
-		std::optional<GatewayHealthResponse> fallbackHealth;
+		// Runs in the background, so the lease keeps being renewed while the processors answer.
+		std::future<void> healthPoll;
 
 		while (!SignalHandling::shouldFinish())
 		{
-			auto currentChoice = static_cast<PaymentGateway>(sharedMemoryManager.data->currentGateway.load());
-			const auto now = std::chrono::steady_clock::now();
+			const auto now = getSteadyNanos();
+			const auto pollTime = std::chrono::duration_cast<std::chrono::nanoseconds>(POLL_TIME).count();
 
-			if (now - lastDefaultCheck >= POLL_TIME)
-			{
-				if (const auto newDefaultHealth = getGatewayHealth(Config::processorDefaultUrl))
-					defaultHealth = newDefaultHealth.value();
+			if (healthPoll.valid() && healthPoll.wait_for(std::chrono::seconds::zero()) == std::future_status::ready)
+				healthPoll.get();
 
-				lastDefaultCheck = now;
+			if (holdHealthLease() && !healthPoll.valid() && now - getSharedData().lastHealthPollAt.load() >= pollTime)
+			{
+				getSharedData().lastHealthPollAt.store(now);
+				healthPoll = std::async(std::launch::async, pollHealth);
 			}
 
-			if (now - lastFallbackCheck >= POLL_TIME)
-			{
-				if (const auto newFallbackHealth = getGatewayHealth(Config::processorFallbackUrl))
-					fallbackHealth = newFallbackHealth.value();
+			std::this_thread::sleep_for(LEASE_CHECK_INTERVAL);
+		}
 
-				lastFallbackCheck = now;
-			}
+		if (healthPoll.valid())
+			healthPoll.wait();
 
-			PaymentGateway newChoice = currentChoice;
+		releaseHealthLease();
 
-			if (defaultHealth && fallbackHealth)
-			{
-				if (!defaultHealth->failing && !fallbackHealth->failing)
-				{
-					if (defaultHealth->minResponseTime > 100 &&
-						defaultHealth->minResponseTime > fallbackHealth->minResponseTime * 2)
-					{
-						newChoice = PaymentGateway::FALLBACK;
-					}
-					else
-						newChoice = PaymentGateway::DEFAULT;
-				}
-				else if (!defaultHealth->failing && fallbackHealth->failing)
-					newChoice = PaymentGateway::DEFAULT;
-				else if (defaultHealth->failing && !fallbackHealth->failing)
-					newChoice = PaymentGateway::FALLBACK;
-				else
-					newChoice = PaymentGateway::DEFAULT;
-			}
-			else if (defaultHealth && !fallbackHealth)
-			{
-				if (!defaultHealth->failing)
-					newChoice = PaymentGateway::DEFAULT;
-				else
-					newChoice = PaymentGateway::FALLBACK;
-			}
-			else if (!defaultHealth && fallbackHealth)
-			{
-				if (!fallbackHealth->failing)
-				{
-					newChoice =
-						currentChoice == PaymentGateway::DEFAULT ? PaymentGateway::DEFAULT : PaymentGateway::FALLBACK;
-				}
-				else
-					newChoice = PaymentGateway::DEFAULT;
-			}
-			else
-				newChoice = PaymentGateway::DEFAULT;
+		std::println("GatewayChooserService stopped.");
+	}
 
-			if (newChoice != currentChoice)
-			{
-				currentChoice = newChoice;
-				sharedMemoryManager.data->currentGateway = static_cast<std::uint8_t>(currentChoice);
+	// Acquires or renews the lease.
+	bool GatewayChooserService::holdHealthLease()
+	{
+		auto& lease = getSharedData().healthLease;
+		const auto holder = static_cast<std::uint64_t>(Config::instanceId + 1);
+		const auto now = getSteadyNanos() / 1'000'000;
+		auto current = lease.load();
 
-				std::println(
-					"Gateway switched to: {}", currentChoice == PaymentGateway::DEFAULT ? "DEFAULT" : "FALLBACK");
-			}
+		if ((current & 0xFF) != holder && static_cast<std::int64_t>(current >> 8) > now)
+			return false;
 
-			if (defaultHealth.has_value())
-			{
-				std::println("DEFAULT health: failing: {}, minResponseTime: {}", defaultHealth->failing,
-					defaultHealth->minResponseTime);
-			}
+		const auto expiresAt = now + LEASE_TIME.count();
 
-			if (fallbackHealth.has_value())
-			{
-				std::println("FALLBACK health: failing: {}, minResponseTime: {}", fallbackHealth->failing,
-					fallbackHealth->minResponseTime);
-			}
+		if (!lease.compare_exchange_strong(current, static_cast<std::uint64_t>(expiresAt) << 8 | holder))
+			return false;
 
-			std::println("Current gateway: {}", currentChoice == PaymentGateway::DEFAULT ? "DEFAULT" : "FALLBACK");
+		if ((current & 0xFF) != holder)
+			std::println("Health polling lease acquired.");
 
-			std::fflush(stdout);
+		return true;
+	}
+
+	// Lets another instance take over immediately.
+	void GatewayChooserService::releaseHealthLease()
+	{
+		auto& lease = getSharedData().healthLease;
+		auto current = lease.load();
 
-			std::this_thread::sleep_for(POLL_TIME);
+		if ((current & 0xFF) == Config::instanceId + 1)
+			lease.compare_exchange_strong(current, 0);
+	}
+
+	// Queries both processors concurrently.
+	void GatewayChooserService::pollHealth()
+	{
+		auto defaultHealthFuture =
+			std::async(std::launch::async, getGatewayHealth, std::cref(Config::processorDefaultUrl), HEALTH_TIMEOUT);
+		auto fallbackHealthFuture =
+			std::async(std::launch::async, getGatewayHealth, std::cref(Config::processorFallbackUrl), HEALTH_TIMEOUT);
+
+		const auto defaultHealth = defaultHealthFuture.get();
+		const auto fallbackHealth = fallbackHealthFuture.get();
+
+		if (defaultHealth.has_value())
+		{
+			GatewayStats::recordHealth(PaymentGateway::DEFAULT,
+				std::chrono::milliseconds(defaultHealth->minResponseTime), defaultHealth->failing);
+
+			std::println("DEFAULT health: failing: {}, minResponseTime: {}", defaultHealth->failing,
+				defaultHealth->minResponseTime);
 		}
 
-		std::println("GatewayChooserService stopped.");
+		if (fallbackHealth.has_value())
+		{
+			GatewayStats::recordHealth(PaymentGateway::FALLBACK,
+				std::chrono::milliseconds(fallbackHealth->minResponseTime), fallbackHealth->failing);
+
+			std::println("FALLBACK health: failing: {}, minResponseTime: {}", fallbackHealth->failing,
+				fallbackHealth->minResponseTime);
+		}
+
+		evaluate(true);
+
+		for (const auto gateway : {PaymentGateway::DEFAULT, PaymentGateway::FALLBACK})
+		{
+			const auto stats = GatewayStats::get(gateway);
+
+			std::println("{} stats: latency: {:.0f}us, p99: {}us, errorRate: {:.3f}, concurrencyLimit: {}",
+				gateway == PaymentGateway::DEFAULT ? "DEFAULT" : "FALLBACK", stats.latencyMicros,
+				stats.p99LatencyMicros, stats.errorRate, ConcurrencyLimiter::get(gateway).getLimit());
+		}
+
+		std::println("Current gateway: {}", getGateway() == PaymentGateway::DEFAULT ? "DEFAULT" : "FALLBACK");
+
+		std::fflush(stdout);
 	}
 
-	PaymentGateway GatewayChooserService::getGateway()
+	void GatewayChooserService::reportPayment(PaymentGateway gateway, std::chrono::microseconds latency, bool failed)
 	{
-		return static_cast<PaymentGateway>(sharedMemoryManager.data->currentGateway.load());
+		Metrics::increment(Metrics::forGateway(Metrics::Counter::UPSTREAM_CALLS_DEFAULT, gateway));
+
+		if (failed)
+			Metrics::increment(Metrics::forGateway(Metrics::Counter::UPSTREAM_ERRORS_DEFAULT, gateway));
+
+		Metrics::record(Metrics::forGateway(Metrics::Histogram::UPSTREAM_LATENCY_DEFAULT, gateway), latency);
+
+		GatewayStats::record(gateway, latency, failed);
+		evaluate(false);
 	}
 
-	void GatewayChooserService::switchGatewayTo(PaymentGateway gateway)
+	void GatewayChooserService::evaluate(bool force)
+	{
+		auto& sharedData = getSharedData();
+		const auto now = getSteadyNanos();
+		auto lastEvaluationAt = sharedData.lastGatewayEvaluationAt.load(std::memory_order_relaxed);
+
+		const auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(EVALUATION_INTERVAL).count();
+
+		if (!force &&
+			(now - lastEvaluationAt < interval ||
+				!sharedData.lastGatewayEvaluationAt.compare_exchange_strong(
+					lastEvaluationAt, now, std::memory_order_relaxed)))
+		{
+			return;
+		}
+
+		GatewayStats::decay();
+
+		const auto currentChoice = getGateway();
+		const auto newChoice = choose(currentChoice);
+
+		if (newChoice != currentChoice)
+		{
+			auto expected = std::to_underlying(currentChoice);
+
+			if (sharedData.currentGateway.compare_exchange_strong(expected, std::to_underlying(newChoice)))
+			{
+				std::println(
+					"Gateway switched to: {}", newChoice == PaymentGateway::DEFAULT ? "DEFAULT" : "FALLBACK");
+			}
+		}
+	}
+
+	// Prefers the default gateway, which has lower fees, unless it's failing or much slower than the fallback one.
+	// The thresholds to leave the current gateway are stricter than the ones to stay on it.
+	PaymentGateway GatewayChooserService::choose(PaymentGateway currentChoice)
+	{
+		const auto defaultStats = GatewayStats::get(PaymentGateway::DEFAULT);
+		const auto fallbackStats = GatewayStats::get(PaymentGateway::FALLBACK);
+		const bool onDefault = currentChoice == PaymentGateway::DEFAULT;
+
+		const auto isFailing = [&](PaymentGateway gateway, const GatewayStats::Snapshot& stats, bool current)
+		{
+			if (CircuitBreaker::getState(gateway) == CircuitBreaker::State::OPEN)
+				return true;
+
+			return stats.hasSamples &&
+				(stats.errorRate > (current ? SWITCH_ERROR_RATE : RETURN_ERROR_RATE) ||
+					stats.p99LatencyMicros >=
+						static_cast<std::uint64_t>(
+							std::chrono::duration_cast<std::chrono::microseconds>(Config::processorTimeout).count()));
+		};
+
+		const bool defaultFailing = isFailing(PaymentGateway::DEFAULT, defaultStats, onDefault);
+		const bool fallbackFailing = isFailing(PaymentGateway::FALLBACK, fallbackStats, !onDefault);
+
+		if (defaultFailing != fallbackFailing)
+			return defaultFailing ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT;
+		else if (defaultFailing || !defaultStats.hasSamples || !fallbackStats.hasSamples)
+			return PaymentGateway::DEFAULT;
+
+		const bool defaultSlow = onDefault
+			? defaultStats.latencyMicros > SWITCH_LATENCY_MICROS &&
+				defaultStats.latencyMicros > fallbackStats.latencyMicros * SWITCH_LATENCY_RATIO
+			: defaultStats.latencyMicros > RETURN_LATENCY_MICROS &&
+				defaultStats.latencyMicros > fallbackStats.latencyMicros * RETURN_LATENCY_RATIO;
+
+		return defaultSlow ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT;
+	}
+
+	PaymentGateway GatewayChooserService::getGateway()
 	{
-		sharedMemoryManager.data->currentGateway = std::to_underlying(gateway);
+		return static_cast<PaymentGateway>(getSharedData().currentGateway.load());
 	}
 }  // namespace rinhaback::api
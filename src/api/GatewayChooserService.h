@@ -15,12 +15,34 @@ namespace rinhaback::api
 	public:
 		static std::jthread start();
 		static PaymentGateway getGateway();
-		static void switchGatewayTo(PaymentGateway gateway);
+
+		// Records the outcome of a payment call and re-evaluates the gateway choice, at most once per
+		// EVALUATION_INTERVAL across all instances.
+		static void reportPayment(PaymentGateway gateway, std::chrono::microseconds latency, bool failed);
 
 	private:
 		static void handler();
+		static bool holdHealthLease();
+		static void releaseHealthLease();
+		static void pollHealth();
+		static void evaluate(bool force);
+		static PaymentGateway choose(PaymentGateway currentChoice);
 
 	private:
+		// The processors accept one health request per 5 seconds.
 		static inline constexpr std::chrono::milliseconds POLL_TIME{5010};
+		static inline constexpr std::chrono::milliseconds LEASE_TIME{POLL_TIME * 2};
+		static inline constexpr std::chrono::milliseconds LEASE_CHECK_INTERVAL{100};
+		static inline constexpr std::chrono::seconds HEALTH_TIMEOUT{2};
+		static inline constexpr std::chrono::milliseconds EVALUATION_INTERVAL{5};
+
+		// Thresholds to leave / to come back to the default gateway. Their gap is the hysteresis that avoids
+		// flapping between gateways.
+		static inline constexpr double SWITCH_ERROR_RATE = 0.5;
+		static inline constexpr double RETURN_ERROR_RATE = 0.2;
+		static inline constexpr double SWITCH_LATENCY_MICROS = 100'000;
+		static inline constexpr double RETURN_LATENCY_MICROS = 80'000;
+		static inline constexpr double SWITCH_LATENCY_RATIO = 2.0;
+		static inline constexpr double RETURN_LATENCY_RATIO = 1.5;
 	};
 }  // namespace rinhaback::api
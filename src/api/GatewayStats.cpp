@@ -0,0 +1,126 @@
+#include "./GatewayStats.h"
+#include "./SharedMemory.h"
+#include "./Util.h"
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+
+namespace rinhaback::api
+{
+	using LatencyBuckets = SharedData::GatewayStatsData::HistogramBuckets;
+
+	static void updateEwma(std::atomic<double>& average, double sample, double alpha, bool first)
+	{
+		if (first)
+		{
+			average.store(sample, std::memory_order_relaxed);
+			return;
+		}
+
+		auto current = average.load(std::memory_order_relaxed);
+
+		while (!average.compare_exchange_weak(current, current + alpha * (sample - current), std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void GatewayStats::record(PaymentGateway gateway, std::chrono::microseconds latency, bool failed)
+	{
+		auto& stats = getSharedData().gatewayStats[std::to_underlying(gateway)];
+		const auto micros = static_cast<std::uint64_t>(std::max(latency.count(), std::int64_t(1)));
+
+		// A zero latency means no samples yet.
+		const bool first = stats.latencyMicros.load(std::memory_order_relaxed) == 0;
+
+		updateEwma(stats.latencyMicros, static_cast<double>(micros), LATENCY_ALPHA, first);
+		updateEwma(stats.errorRate, failed ? 1.0 : 0.0, ERROR_RATE_ALPHA, first);
+
+		stats.latencyHistogram[LatencyBuckets::getBucket(micros)].fetch_add(1, std::memory_order_relaxed);
+		stats.lastSampleAt.store(getSteadyNanos(), std::memory_order_relaxed);
+	}
+
+	void GatewayStats::recordHealth(PaymentGateway gateway, std::chrono::milliseconds minResponseTime, bool failing)
+	{
+		auto& stats = getSharedData().gatewayStats[std::to_underlying(gateway)];
+		const auto now = getSteadyNanos();
+
+		if (now - stats.lastSampleAt.load(std::memory_order_relaxed) <
+			std::chrono::duration_cast<std::chrono::nanoseconds>(STALE_TIME).count())
+		{
+			return;
+		}
+
+		const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(minResponseTime).count();
+
+		stats.latencyMicros.store(static_cast<double>(std::max(micros, std::int64_t(1))), std::memory_order_relaxed);
+		stats.errorRate.store(failing ? 1.0 : 0.0, std::memory_order_relaxed);
+
+		for (auto& count : stats.latencyHistogram)
+			count.store(0, std::memory_order_relaxed);
+
+		stats.latencyHistogram[LatencyBuckets::getBucket(static_cast<std::uint64_t>(std::max(micros, std::int64_t(1))))]
+			.store(1, std::memory_order_relaxed);
+	}
+
+	GatewayStats::Snapshot GatewayStats::get(PaymentGateway gateway)
+	{
+		const auto& stats = getSharedData().gatewayStats[std::to_underlying(gateway)];
+
+		Snapshot snapshot{
+			.hasSamples = false,
+			.latencyMicros = stats.latencyMicros.load(std::memory_order_relaxed),
+			.p99LatencyMicros = 0,
+			.errorRate = stats.errorRate.load(std::memory_order_relaxed),
+		};
+
+		snapshot.hasSamples = snapshot.latencyMicros != 0;
+
+		std::uint32_t counts[SharedData::GatewayStatsData::HISTOGRAM_BUCKETS];
+		std::uint64_t total = 0;
+
+		for (unsigned i = 0; i < std::size(counts); ++i)
+		{
+			counts[i] = stats.latencyHistogram[i].load(std::memory_order_relaxed);
+			total += counts[i];
+		}
+
+		const auto threshold = (total * 99 + 99) / 100;
+		std::uint64_t accumulated = 0;
+
+		for (unsigned i = 0; i < std::size(counts) && total > 0; ++i)
+		{
+			accumulated += counts[i];
+
+			if (accumulated >= threshold)
+			{
+				snapshot.p99LatencyMicros = LatencyBuckets::getUpperBound(i);
+				break;
+			}
+		}
+
+		return snapshot;
+	}
+
+	void GatewayStats::decay()
+	{
+		auto& sharedData = getSharedData();
+		const auto now = getSteadyNanos();
+		auto lastDecayAt = sharedData.lastStatsDecayAt.load(std::memory_order_relaxed);
+
+		if (now - lastDecayAt < std::chrono::duration_cast<std::chrono::nanoseconds>(HISTOGRAM_DECAY_TIME).count() ||
+			!sharedData.lastStatsDecayAt.compare_exchange_strong(lastDecayAt, now, std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		for (auto& stats : sharedData.gatewayStats)
+		{
+			for (auto& count : stats.latencyHistogram)
+			{
+				if (const auto value = count.load(std::memory_order_relaxed); value > 1)
+					count.fetch_sub(value / 2, std::memory_order_relaxed);
+			}
+		}
+	}
+}  // namespace rinhaback::api
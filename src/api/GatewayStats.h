@@ -0,0 +1,43 @@
+#pragma once
+
+#include "./Database.h"
+#include <chrono>
+#include <cstdint>
+
+
+namespace rinhaback::api
+{
+	// Per-gateway latency EWMA, latency histogram and error rate EWMA, fed by the real payment calls of all the
+	// instances and kept in shared memory.
+	class GatewayStats final
+	{
+	public:
+		struct Snapshot
+		{
+			bool hasSamples;
+			double latencyMicros;
+			std::uint64_t p99LatencyMicros;
+			double errorRate;
+		};
+
+	public:
+		GatewayStats() = delete;
+
+	public:
+		static void record(PaymentGateway gateway, std::chrono::microseconds latency, bool failed);
+
+		// Health checks only replace the numbers of a gateway that isn't receiving payments.
+		static void recordHealth(PaymentGateway gateway, std::chrono::milliseconds minResponseTime, bool failing);
+
+		static Snapshot get(PaymentGateway gateway);
+
+		// Halves the histograms once per HISTOGRAM_DECAY_TIME, so the p99 follows recent payments.
+		static void decay();
+
+	private:
+		static inline constexpr double LATENCY_ALPHA = 0.05;
+		static inline constexpr double ERROR_RATE_ALPHA = 0.05;
+		static inline constexpr std::chrono::seconds HISTOGRAM_DECAY_TIME{1};
+		static inline constexpr std::chrono::seconds STALE_TIME{1};
+	};
+}  // namespace rinhaback::api
@@ -0,0 +1,212 @@
+#include "./Listener.h"
+#include "./Config.h"
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/filter.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace rinhaback::api
+{
+	static std::runtime_error socketError(const char* operation)
+	{
+		return std::runtime_error(
+			std::format("Cannot {} on {}: {}", operation, Config::listenAddress, std::strerror(errno)));
+	}
+
+	void Listener::listen(std::span<mg_mgr> managers, mg_event_handler_t handler)
+	{
+		static constexpr std::string_view UNIX_PREFIX = "unix:";
+
+		if (Config::listenAddress.starts_with(UNIX_PREFIX))
+		{
+			// Unix sockets can't be sharded with SO_REUSEPORT, and sharing one between managers makes mongoose log an
+			// error for every accept lost to another manager, so only the first manager listens.
+			if (!managers.empty())
+			{
+				const int fd = openUnixSocket(Config::listenAddress.c_str() + UNIX_PREFIX.size());
+				adoptSocket(managers[0], fd, mg_addr{}, handler);
+			}
+
+			return;
+		}
+
+		if (!Config::listenReusePort)
+		{
+			for (auto& mgr : managers)
+				mg_http_listen(&mgr, Config::listenAddress.c_str(), handler, nullptr);
+
+			return;
+		}
+
+		for (std::size_t i = 0; i < managers.size(); ++i)
+		{
+			mg_addr localAddress{};
+			const int fd = openReusePortSocket(
+				Config::listenAddress.c_str(), Config::listenCpuSteering && i == 0, localAddress);
+
+			adoptSocket(managers[i], fd, localAddress, handler);
+		}
+	}
+
+	// Mongoose has no way to adopt a listening socket, so create a listener in an ephemeral port and replace its
+	// socket with ours, keeping the descriptor number. Takes ownership of fd.
+	void Listener::adoptSocket(mg_mgr& mgr, int fd, const mg_addr& localAddress, mg_event_handler_t handler)
+	{
+		const auto conn = mg_http_listen(&mgr, "http://127.0.0.1:0", handler, nullptr);
+
+		if (!conn || dup2(fd, static_cast<int>(reinterpret_cast<std::size_t>(conn->fd))) == -1)
+		{
+			close(fd);
+			throw socketError("listen");
+		}
+
+		close(fd);
+		conn->loc = localAddress;
+	}
+
+	int Listener::openUnixSocket(const char* path)
+	{
+		sockaddr_un sockAddress{};
+		sockAddress.sun_family = AF_UNIX;
+
+		if (std::strlen(path) >= sizeof(sockAddress.sun_path))
+			throw std::runtime_error(std::format("Unix socket path too long: {}", path));
+
+		std::strcpy(sockAddress.sun_path, path);
+
+		// Remove the socket left by a previous run.
+		unlink(path);
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		if (fd == -1)
+			throw socketError("create socket");
+
+		// Let the load balancer connect whatever user it runs as.
+		if (bind(fd, reinterpret_cast<const sockaddr*>(&sockAddress), sizeof(sockAddress)) != 0 ||
+			chmod(path, 0666) != 0 || ::listen(fd, SOMAXCONN) != 0)
+		{
+			const auto error = socketError("bind");
+			close(fd);
+			throw error;
+		}
+
+		return fd;
+	}
+
+	// Sockets are added to the SO_REUSEPORT group in the order they're bound, so the one at index N belongs to
+	// the manager at index N.
+	int Listener::openReusePortSocket(const char* address, bool attachCpuSteering, mg_addr& localAddress)
+	{
+		const std::string_view addressView(address);
+		const auto colon = addressView.rfind(':');
+
+		if (colon == std::string_view::npos)
+			throw std::runtime_error(std::format("Invalid listen address: {}", addressView));
+
+		auto host = std::string(addressView.substr(0, colon));
+		const auto port = std::string(addressView.substr(colon + 1));
+
+		if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+			host = host.substr(1, host.size() - 2);
+
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+		addrinfo* addressInfo;
+
+		if (const auto error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addressInfo))
+		{
+			throw std::runtime_error(
+				std::format("Cannot resolve listen address {}: {}", addressView, gai_strerror(error)));
+		}
+
+		const std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addressInfoHolder(addressInfo, freeaddrinfo);
+
+		const int fd = socket(addressInfo->ai_family, addressInfo->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			addressInfo->ai_protocol);
+
+		if (fd == -1)
+			throw socketError("create socket");
+
+		const int on = 1;
+
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+			setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+			bind(fd, addressInfo->ai_addr, addressInfo->ai_addrlen) != 0 || ::listen(fd, SOMAXCONN) != 0)
+		{
+			const auto error = socketError("bind");
+			close(fd);
+			throw error;
+		}
+
+		if (attachCpuSteering)
+		{
+			// Selects the socket of the first server thread pinned (see CpuAffinity::pin) to the CPU of the softirq,
+			// through a jump table of SERVER_CPUS, so connections are accepted on that CPU. Other CPUs fall back to
+			// the socket with index (CPU % number of sockets).
+			std::vector<sock_filter> code;
+			code.push_back({BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<std::uint32_t>(SKF_AD_OFF + SKF_AD_CPU)});
+
+			std::vector<unsigned> mappedCpus;
+
+			for (unsigned i = 0; i < Config::serverWorkers && !Config::serverCpus.empty(); ++i)
+			{
+				const auto cpu = Config::serverCpus[i % Config::serverCpus.size()];
+
+				if (std::ranges::find(mappedCpus, cpu) != mappedCpus.end())
+					continue;
+
+				mappedCpus.push_back(cpu);
+
+				// When equal, return this socket, otherwise skip the return.
+				code.push_back({BPF_JMP | BPF_JEQ | BPF_K, 0, 1, cpu});
+				code.push_back({BPF_RET | BPF_K, 0, 0, i});
+			}
+
+			code.push_back({BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<std::uint32_t>(Config::serverWorkers)});
+			code.push_back({BPF_RET | BPF_A, 0, 0, 0});
+
+			const sock_fprog program = {.len = static_cast<unsigned short>(code.size()), .filter = code.data()};
+
+			if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0)
+			{
+				const auto error = socketError("attach CPU steering program");
+				close(fd);
+				throw error;
+			}
+		}
+
+		if (addressInfo->ai_family == AF_INET6)
+		{
+			const auto sockAddress = reinterpret_cast<const sockaddr_in6*>(addressInfo->ai_addr);
+			std::memcpy(localAddress.ip, &sockAddress->sin6_addr, sizeof(sockAddress->sin6_addr));
+			localAddress.port = sockAddress->sin6_port;
+			localAddress.is_ip6 = true;
+		}
+		else
+		{
+			const auto sockAddress = reinterpret_cast<const sockaddr_in*>(addressInfo->ai_addr);
+			std::memcpy(localAddress.ip, &sockAddress->sin_addr, sizeof(sockAddress->sin_addr));
+			localAddress.port = sockAddress->sin_port;
+		}
+
+		return fd;
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <span>
+#include "mongoose.h"
+
+
+namespace rinhaback::api
+{
+	class Listener final
+	{
+	public:
+		Listener() = delete;
+
+	public:
+		// Makes each manager listen on LISTEN_ADDRESS.
+		// With LISTEN_REUSE_PORT, each manager gets its own SO_REUSEPORT socket and the kernel balances accepted
+		// connections between them, instead of all of them racing for a single socket.
+		// A "unix:<path>" address creates a Unix domain socket served by the first manager.
+		static void listen(std::span<mg_mgr> managers, mg_event_handler_t handler);
+
+	private:
+		static void adoptSocket(mg_mgr& mgr, int fd, const mg_addr& localAddress, mg_event_handler_t handler);
+		static int openUnixSocket(const char* path);
+		static int openReusePortSocket(const char* address, bool attachCpuSteering, mg_addr& localAddress);
+	};
+}  // namespace rinhaback::api
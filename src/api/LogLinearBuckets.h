@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+
+namespace rinhaback::api
+{
+	// Log-linear histogram buckets of unsigned values: values up to 2^(SUB_BITS + 1) have their own bucket (0 shares
+	// the one of 1), and the others share a bucket with the values whose predecessors have the same bit width and the
+	// same SUB_BITS bits after the highest one, so a bucket is narrower than 2^-SUB_BITS of its values. Upper bounds
+	// are inclusive, as the Prometheus le label. Values wider than MAX_BITS go to the last bucket.
+	template <unsigned SUB_BITS, unsigned MAX_BITS>
+	class LogLinearBuckets final
+	{
+	private:
+		static inline constexpr unsigned SUB_BUCKETS = 1u << SUB_BITS;
+
+	public:
+		static inline constexpr unsigned COUNT = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+	public:
+		LogLinearBuckets() = delete;
+
+	public:
+		static constexpr unsigned getBucket(std::uint64_t value)
+		{
+			// Shifting by one makes the upper bounds inclusive.
+			if (value > 0)
+				--value;
+
+			if (value < SUB_BUCKETS * 2)
+				return static_cast<unsigned>(value);
+
+			const auto width = static_cast<unsigned>(std::bit_width(value));
+			const auto subBucket = static_cast<unsigned>(value >> (width - SUB_BITS - 1)) - SUB_BUCKETS;
+
+			return std::min((width - SUB_BITS) * SUB_BUCKETS + subBucket, COUNT - 1);
+		}
+
+		static constexpr std::uint64_t getUpperBound(unsigned bucket)
+		{
+			if (bucket < SUB_BUCKETS * 2)
+				return bucket + 1;
+
+			const auto width = bucket / SUB_BUCKETS + SUB_BITS;
+			const auto subBucket = bucket % SUB_BUCKETS;
+
+			return std::uint64_t(SUB_BUCKETS + subBucket + 1) << (width - SUB_BITS - 1);
+		}
+	};
+}  // namespace rinhaback::api
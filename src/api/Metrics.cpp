@@ -0,0 +1,221 @@
+#include "./Metrics.h"
+#include "./CircuitBreaker.h"
+#include "./Config.h"
+#include "./SharedMemory.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <format>
+#include <iterator>
+#include <string_view>
+
+
+namespace rinhaback::api
+{
+	namespace
+	{
+		struct Descriptor
+		{
+			std::string_view name;
+			std::string_view labels;
+			std::string_view help;
+		};
+	}  // namespace
+
+	// Variants of the same metric (differing by labels) must be consecutive.
+	static constexpr Descriptor COUNTER_DESCRIPTORS[] = {
+		{"rinhaback_payments_received_total", "", "Payments accepted by POST /payments."},
+		{"rinhaback_payments_rejected_total", "", "Payments refused because the pending queue was full."},
+		{"rinhaback_payments_processed_total", R"(gateway="default")", "Payments accepted by a processor."},
+		{"rinhaback_payments_processed_total", R"(gateway="fallback")", ""},
+		{"rinhaback_upstream_calls_total", R"(gateway="default")", "Payment calls to a processor."},
+		{"rinhaback_upstream_calls_total", R"(gateway="fallback")", ""},
+		{"rinhaback_upstream_errors_total", R"(gateway="default")",
+			"Payment calls to a processor which failed or timed out."},
+		{"rinhaback_upstream_errors_total", R"(gateway="fallback")", ""},
+		{"rinhaback_payments_retried_total", "", "Payments scheduled for a retry."},
+		{"rinhaback_commit_failures_total", "", "Group commits which failed."},
+		{"rinhaback_commits_dropped_total", "", "Acknowledged payments dropped after failing to commit."},
+		{"rinhaback_summary_flush_timeouts_total", "",
+			"Summaries answered before all the acknowledged payments were committed."},
+	};
+
+	static constexpr Descriptor HISTOGRAM_DESCRIPTORS[] = {
+		{"rinhaback_queue_wait_seconds", "", "Time from enqueue to dequeue in the pending payments queue."},
+		{"rinhaback_upstream_latency_seconds", R"(gateway="default")", "Latency of the payment calls to a processor."},
+		{"rinhaback_upstream_latency_seconds", R"(gateway="fallback")", ""},
+		{"rinhaback_write_transaction_seconds", "", "Duration of the LMDB write transactions storing payments."},
+		{"rinhaback_summary_scan_seconds", "", "Duration of the payments summary queries."},
+	};
+
+	static constexpr Descriptor GAUGE_DESCRIPTORS[] = {
+		{"rinhaback_queue_depth", "", "Payments waiting in the pending queue."},
+		{"rinhaback_concurrency_limit", R"(gateway="default")", "In-flight payments allowed by the limiter."},
+		{"rinhaback_concurrency_limit", R"(gateway="fallback")", ""},
+		{"rinhaback_in_flight", R"(gateway="default")", "Payment calls in flight."},
+		{"rinhaback_in_flight", R"(gateway="fallback")", ""},
+	};
+
+	static_assert(std::size(COUNTER_DESCRIPTORS) == std::to_underlying(Metrics::Counter::SIZE));
+	static_assert(std::size(HISTOGRAM_DESCRIPTORS) == std::to_underlying(Metrics::Histogram::SIZE));
+	static_assert(std::size(GAUGE_DESCRIPTORS) == std::to_underlying(Metrics::Gauge::SIZE));
+
+	// Main, committer, gateway chooser and retry scheduler.
+	static constexpr unsigned AUXILIARY_THREADS = 4;
+
+	static SharedData::MetricsShard& getShard()
+	{
+		static std::atomic_uint nextShard{0};
+
+		thread_local auto& shard = []() -> SharedData::MetricsShard&
+		{
+			const auto shards = getSharedData().getMetricsShards(Config::instanceId);
+			return shards[nextShard.fetch_add(1, std::memory_order_relaxed) % shards.size()];
+		}();
+
+		return shard;
+	}
+
+	unsigned Metrics::getShardCount()
+	{
+		return Config::serverWorkers + Config::processorWorkers + Config::summaryWorkers + AUXILIARY_THREADS;
+	}
+
+	void Metrics::increment(Counter counter, std::uint64_t value)
+	{
+		getShard().counters[std::to_underlying(counter)].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	void Metrics::record(Histogram histogram, std::chrono::nanoseconds duration)
+	{
+		const auto micros = static_cast<std::uint64_t>(
+			std::max(std::chrono::duration_cast<std::chrono::microseconds>(duration).count(), std::int64_t(0)));
+		auto& data = getShard().histograms[std::to_underlying(histogram)];
+
+		data.buckets[HistogramBuckets::getBucket(micros)].fetch_add(1, std::memory_order_relaxed);
+		data.count.fetch_add(1, std::memory_order_relaxed);
+		data.sumMicros.fetch_add(micros, std::memory_order_relaxed);
+	}
+
+	void Metrics::set(Gauge gauge, std::int64_t value)
+	{
+		getSharedData().instances[Config::instanceId].gauges[std::to_underlying(gauge)].store(
+			value, std::memory_order_relaxed);
+	}
+
+	static void formatHeader(std::string& out, const Descriptor& descriptor, std::string_view type)
+	{
+		if (!descriptor.help.empty())
+		{
+			std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", descriptor.name, descriptor.help,
+				descriptor.name, type);
+		}
+	}
+
+	static std::string joinLabels(std::string_view labels, std::string_view extraLabel)
+	{
+		if (labels.empty())
+			return std::string(extraLabel);
+		else if (extraLabel.empty())
+			return std::string(labels);
+		else
+			return std::format("{},{}", labels, extraLabel);
+	}
+
+	static void formatSample(std::string& out, std::string_view name, std::string_view labels, auto value)
+	{
+		if (labels.empty())
+			std::format_to(std::back_inserter(out), "{} {}\n", name, value);
+		else
+			std::format_to(std::back_inserter(out), "{}{{{}}} {}\n", name, labels, value);
+	}
+
+	std::string Metrics::format()
+	{
+		const auto& sharedData = getSharedData();
+		std::string out;
+
+		for (unsigned counter = 0; counter < std::size(COUNTER_DESCRIPTORS); ++counter)
+		{
+			const auto& descriptor = COUNTER_DESCRIPTORS[counter];
+			std::uint64_t total = 0;
+
+			for (unsigned instance = 0; instance < SharedData::MAX_INSTANCES; ++instance)
+			{
+				for (const auto& shard : sharedData.getMetricsShards(instance))
+					total += shard.counters[counter].load(std::memory_order_relaxed);
+			}
+
+			formatHeader(out, descriptor, "counter");
+			formatSample(out, descriptor.name, descriptor.labels, total);
+		}
+
+		for (unsigned histogram = 0; histogram < std::size(HISTOGRAM_DESCRIPTORS); ++histogram)
+		{
+			const auto& descriptor = HISTOGRAM_DESCRIPTORS[histogram];
+			std::uint64_t buckets[HISTOGRAM_BUCKETS] = {};
+			std::uint64_t count = 0;
+			std::uint64_t sumMicros = 0;
+
+			for (unsigned instance = 0; instance < SharedData::MAX_INSTANCES; ++instance)
+			{
+				for (const auto& shard : sharedData.getMetricsShards(instance))
+				{
+					const auto& data = shard.histograms[histogram];
+
+					for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+						buckets[bucket] += data.buckets[bucket].load(std::memory_order_relaxed);
+
+					count += data.count.load(std::memory_order_relaxed);
+					sumMicros += data.sumMicros.load(std::memory_order_relaxed);
+				}
+			}
+
+			formatHeader(out, descriptor, "histogram");
+
+			const auto bucketName = std::format("{}_bucket", descriptor.name);
+			std::uint64_t accumulated = 0;
+
+			// Exported with one bucket per power of two.
+			for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+			{
+				accumulated += buckets[bucket];
+
+				if (const auto upperBound = HistogramBuckets::getUpperBound(bucket); std::has_single_bit(upperBound))
+				{
+					formatSample(out, bucketName,
+						joinLabels(descriptor.labels, std::format(R"(le="{}")", upperBound / 1e6)), accumulated);
+				}
+			}
+
+			formatSample(out, bucketName, joinLabels(descriptor.labels, R"(le="+Inf")"), accumulated);
+			formatSample(out, std::format("{}_sum", descriptor.name), descriptor.labels, sumMicros / 1e6);
+			formatSample(out, std::format("{}_count", descriptor.name), descriptor.labels, count);
+		}
+
+		for (unsigned gauge = 0; gauge < std::size(GAUGE_DESCRIPTORS); ++gauge)
+		{
+			const auto& descriptor = GAUGE_DESCRIPTORS[gauge];
+
+			formatHeader(out, descriptor, "gauge");
+
+			for (unsigned instance = 0; instance < SharedData::MAX_INSTANCES; ++instance)
+			{
+				formatSample(out, descriptor.name,
+					joinLabels(descriptor.labels, std::format(R"(instance="{}")", instance)),
+					sharedData.instances[instance].gauges[gauge].load(std::memory_order_relaxed));
+			}
+		}
+
+		formatHeader(out, {"rinhaback_circuit_breaker_state", "", "0: closed, 1: open, 2: half-open."}, "gauge");
+		formatSample(out, "rinhaback_circuit_breaker_state", R"(gateway="default")",
+			std::to_underlying(CircuitBreaker::getState(PaymentGateway::DEFAULT)));
+		formatSample(out, "rinhaback_circuit_breaker_state", R"(gateway="fallback")",
+			std::to_underlying(CircuitBreaker::getState(PaymentGateway::FALLBACK)));
+
+		formatHeader(out, {"rinhaback_current_gateway", "", "0: default, 1: fallback."}, "gauge");
+		formatSample(out, "rinhaback_current_gateway", "", sharedData.currentGateway.load(std::memory_order_relaxed));
+
+		return out;
+	}
+}  // namespace rinhaback::api
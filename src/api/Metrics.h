@@ -0,0 +1,105 @@
+#pragma once
+
+#include "./Database.h"
+#include "./LogLinearBuckets.h"
+#include <chrono>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+
+namespace rinhaback::api
+{
+	// Counters and log-linear (HDR-style) histograms recorded into per-thread shards of shared memory, so threads
+	// don't share cache lines, and gauges published per instance. format() sums the shards of all the instances.
+	// There is a shard per thread of the configuration (see getShardCount). Only threads beyond it share shards.
+	class Metrics final
+	{
+	public:
+		enum class Counter : unsigned
+		{
+			PAYMENTS_RECEIVED,
+			PAYMENTS_REJECTED,
+			PAYMENTS_PROCESSED_DEFAULT,
+			PAYMENTS_PROCESSED_FALLBACK,
+			UPSTREAM_CALLS_DEFAULT,
+			UPSTREAM_CALLS_FALLBACK,
+			UPSTREAM_ERRORS_DEFAULT,
+			UPSTREAM_ERRORS_FALLBACK,
+			PAYMENTS_RETRIED,
+			COMMIT_FAILURES,
+			COMMITS_DROPPED,
+			SUMMARY_FLUSH_TIMEOUTS,
+			SIZE
+		};
+
+		enum class Histogram : unsigned
+		{
+			QUEUE_WAIT,
+			UPSTREAM_LATENCY_DEFAULT,
+			UPSTREAM_LATENCY_FALLBACK,
+			WRITE_TRANSACTION,
+			SUMMARY_SCAN,
+			SIZE
+		};
+
+		enum class Gauge : unsigned
+		{
+			QUEUE_DEPTH,
+			CONCURRENCY_LIMIT_DEFAULT,
+			CONCURRENCY_LIMIT_FALLBACK,
+			IN_FLIGHT_DEFAULT,
+			IN_FLIGHT_FALLBACK,
+			SIZE
+		};
+
+		// Records the time from its construction to its destruction.
+		class Timer final
+		{
+		public:
+			explicit Timer(Histogram histogram)
+				: histogram(histogram),
+				  start(std::chrono::steady_clock::now())
+			{
+			}
+
+			~Timer()
+			{
+				record(histogram, std::chrono::steady_clock::now() - start);
+			}
+
+			Timer(const Timer&) = delete;
+			Timer& operator=(const Timer&) = delete;
+
+		private:
+			Histogram histogram;
+			std::chrono::steady_clock::time_point start;
+		};
+
+	public:
+		// Microseconds, exact up to 16us and then with 12.5% precision up to 2^32us.
+		using HistogramBuckets = LogLinearBuckets<3, 32>;
+		static inline constexpr unsigned HISTOGRAM_BUCKETS = HistogramBuckets::COUNT;
+
+	public:
+		Metrics() = delete;
+
+	public:
+		// The gateway variant of a metric, which must be declared right after its DEFAULT one.
+		template <typename T>
+		static T forGateway(T defaultMetric, PaymentGateway gateway)
+		{
+			return static_cast<T>(std::to_underlying(defaultMetric) + std::to_underlying(gateway));
+		}
+
+		static void increment(Counter counter, std::uint64_t value = 1);
+		static void record(Histogram histogram, std::chrono::nanoseconds duration);
+		static void set(Gauge gauge, std::int64_t value);
+
+		// Prometheus text exposition format.
+		static std::string format();
+
+		// Number of threads recording metrics in an instance.
+		static unsigned getShardCount();
+	};
+}  // namespace rinhaback::api
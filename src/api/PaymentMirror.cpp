@@ -0,0 +1,207 @@
+#include "./PaymentMirror.h"
+#include "./Config.h"
+#include "./SharedMemory.h"
+#include <algorithm>
+#include <system_error>
+#include <cerrno>
+#include <cstddef>
+#include <new>
+
+
+namespace rinhaback::api
+{
+	static constexpr const char* MIRROR_NAME = "PaymentMirror";
+
+	PaymentMirror::PaymentMirror(std::unique_ptr<SharedMemorySegment> segment)
+		: segment(std::move(segment))
+	{
+		const auto address = static_cast<std::byte*>(this->segment->getAddress());
+		const auto sharedCapacity = reinterpret_cast<std::uint64_t*>(address);
+
+		headers = reinterpret_cast<Header*>(address + PREFIX_SIZE);
+		columns = reinterpret_cast<std::int64_t*>(
+			address + PREFIX_SIZE + sizeof(Header) * std::to_underlying(PaymentGateway::SIZE));
+
+		if (Config::databaseInit)
+		{
+			capacity = *sharedCapacity = Config::paymentMirrorCapacity;
+
+			pthread_mutexattr_t mutexAttributes;
+			pthread_mutexattr_init(&mutexAttributes);
+			pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+			pthread_mutexattr_setrobust(&mutexAttributes, PTHREAD_MUTEX_ROBUST);
+
+			for (unsigned i = 0; i < std::to_underlying(PaymentGateway::SIZE); ++i)
+			{
+				new (&headers[i]) Header;
+				pthread_mutex_init(&headers[i].writeMutex, &mutexAttributes);
+			}
+
+			pthread_mutexattr_destroy(&mutexAttributes);
+
+			rebuild();
+			this->segment->markReady();
+		}
+		else
+			capacity = *sharedCapacity;
+	}
+
+	PaymentMirror::~PaymentMirror() = default;
+
+	PaymentMirror* PaymentMirror::get()
+	{
+		static const std::unique_ptr<PaymentMirror> mirror = Config::paymentMirror
+			? std::make_unique<PaymentMirror>(std::make_unique<SharedMemorySegment>(
+				  MIRROR_NAME, getSharedSize(Config::paymentMirrorCapacity), Config::databaseInit))
+			: nullptr;
+
+		return mirror.get();
+	}
+
+	void PaymentMirror::add(
+		PaymentGateway gateway, std::uint64_t generation, std::int64_t dateTime, std::int64_t amountCents)
+	{
+		auto& header = headers[std::to_underlying(gateway)];
+
+		lock(header);
+
+		const auto count = header.count.load(std::memory_order_relaxed);
+
+		if (header.generation.load(std::memory_order_relaxed) != generation)
+		{
+			// Committed before a purge.
+		}
+		else if (count == capacity)
+			header.invalidated.store(true, std::memory_order_relaxed);
+		else if (!header.invalidated.load(std::memory_order_relaxed))
+		{
+			const auto dateTimes = getDateTimes(gateway);
+			const auto amountsCents = getAmountsCents(gateway);
+			auto position = count;
+
+			while (position > 0 && dateTimes[position - 1] > dateTime)
+				--position;
+
+			std::copy_backward(dateTimes + position, dateTimes + count, dateTimes + count + 1);
+			std::copy_backward(amountsCents + position, amountsCents + count, amountsCents + count + 1);
+
+			dateTimes[position] = dateTime;
+			amountsCents[position] = amountCents;
+
+			header.count.store(count + 1, std::memory_order_relaxed);
+		}
+
+		unlock(header);
+	}
+
+	std::optional<PaymentRepository::PaymentsGatewaySummaryResponse> PaymentMirror::getPaymentsSummary(
+		PaymentGateway gateway, std::optional<std::int64_t> from, std::optional<std::int64_t> to) const
+	{
+		const auto& header = headers[std::to_underlying(gateway)];
+		const auto dateTimes = getDateTimes(gateway);
+		const auto amountsCents = getAmountsCents(gateway);
+
+		for (unsigned attempt = 0; attempt < READ_ATTEMPTS; ++attempt)
+		{
+			const auto sequence = header.sequence.load(std::memory_order_acquire);
+
+			if (sequence % 2 != 0)
+			{
+				__builtin_ia32_pause();
+				continue;
+			}
+
+			if (header.invalidated.load(std::memory_order_relaxed))
+				return std::nullopt;
+
+			// Values read while a writer changes the columns may be garbage, but always within the arrays.
+			const auto count = std::min(header.count.load(std::memory_order_relaxed), capacity);
+			const auto begin = from ? std::lower_bound(dateTimes, dateTimes + count, *from) : dateTimes;
+			const auto end = to ? std::upper_bound(begin, dateTimes + count, *to) : dateTimes + count;
+
+			const PaymentRepository::PaymentsGatewaySummaryResponse response = {
+				.totalRequests = static_cast<unsigned>(end - begin),
+				.totalAmountCents =
+					sumAmounts(amountsCents + (begin - dateTimes), static_cast<std::size_t>(end - begin)),
+			};
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (header.sequence.load(std::memory_order_relaxed) == sequence)
+				return response;
+		}
+
+		return std::nullopt;
+	}
+
+	void PaymentMirror::purge(PaymentGateway gateway)
+	{
+		auto& header = headers[std::to_underlying(gateway)];
+
+		lock(header);
+		header.generation.fetch_add(1, std::memory_order_relaxed);
+		header.count.store(0, std::memory_order_relaxed);
+		header.invalidated.store(false, std::memory_order_relaxed);
+		unlock(header);
+	}
+
+	void PaymentMirror::invalidate(PaymentGateway gateway)
+	{
+		auto& header = headers[std::to_underlying(gateway)];
+
+		lock(header);
+		header.invalidated.store(true, std::memory_order_relaxed);
+		unlock(header);
+	}
+
+	__attribute__((target_clones("avx2", "default"))) std::int64_t PaymentMirror::sumAmounts(
+		const std::int64_t* amountsCents, std::size_t count)
+	{
+		std::int64_t sum = 0;
+
+		for (std::size_t i = 0; i < count; ++i)
+			sum += amountsCents[i];
+
+		return sum;
+	}
+
+	void PaymentMirror::rebuild()
+	{
+		Transaction transaction(getConnection(), MDB_RDONLY);
+
+		for (const auto gateway : {PaymentGateway::DEFAULT, PaymentGateway::FALLBACK})
+		{
+			const auto generation = getGeneration(gateway);
+
+			PaymentRepository(gateway).forEachPayment(transaction, [&](std::int64_t dateTime, std::int64_t amountCents)
+				{ add(gateway, generation, dateTime, amountCents); });
+		}
+	}
+
+	void PaymentMirror::lock(Header& header)
+	{
+		const auto result = pthread_mutex_lock(&header.writeMutex);
+
+		if (result == EOWNERDEAD)
+		{
+			// The previous writer died holding the mutex, maybe halfway through moving entries, so the columns
+			// can't be trusted anymore. Its sequence may be left odd, and this writer takes it over as is.
+			header.invalidated.store(true, std::memory_order_relaxed);
+			pthread_mutex_consistent(&header.writeMutex);
+		}
+		else if (result != 0)
+			throw std::system_error(result, std::generic_category(), "pthread_mutex_lock");
+
+		if (header.sequence.load(std::memory_order_relaxed) % 2 == 0)
+			header.sequence.fetch_add(1, std::memory_order_relaxed);
+
+		// Readers seeing any of the following writes also see the odd sequence.
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void PaymentMirror::unlock(Header& header)
+	{
+		header.sequence.fetch_add(1, std::memory_order_release);
+		pthread_mutex_unlock(&header.writeMutex);
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "./Database.h"
+#include "./PaymentRepository.h"
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+
+
+namespace rinhaback::api
+{
+	class SharedMemorySegment;
+
+	// Opt-in (PAYMENT_MIRROR=true) columnar copy of the committed payments, shared by all instances: per gateway,
+	// the payment times and amounts (cents) in two arrays sorted by time. A summary is then two binary searches and
+	// a vectorized sum of contiguous memory, without LMDB.
+	// Writers of all processes serialize through a process-shared robust mutex, and bump a seqlock sequence that
+	// readers use to retry a summary a writer overlapped. Payments arrive nearly in time order, so inserting moves
+	// a few entries at most. LMDB stays the source of truth: the creator instance rebuilds the mirror from it, and
+	// summaries fall back to it when the mirror is invalidated (it overflowed PAYMENT_MIRROR_CAPACITY, a writer
+	// died mid-update or a purge failed, until the next purge) or writers keep a reader out.
+	// Purges run inside the LMDB write transaction and bump a generation, which committers read inside theirs, so
+	// a payment committed before a purge is never added after it.
+	class PaymentMirror final
+	{
+	private:
+		struct alignas(64) Header
+		{
+			pthread_mutex_t writeMutex;
+			std::atomic_uint64_t sequence{0};  // odd while a writer changes the columns
+			std::atomic_uint64_t count{0};
+			std::atomic_bool invalidated{false};
+			std::atomic_uint64_t generation{0};  // bumped by purge
+		};
+
+	public:
+		explicit PaymentMirror(std::unique_ptr<SharedMemorySegment> segment);
+		~PaymentMirror();
+
+		PaymentMirror(const PaymentMirror&) = delete;
+		PaymentMirror& operator=(const PaymentMirror&) = delete;
+
+	public:
+		// The mirror of this process, or nullptr when disabled.
+		static PaymentMirror* get();
+
+	public:
+		// To be read inside the write transaction committing a payment, and passed to add().
+		std::uint64_t getGeneration(PaymentGateway gateway) const
+		{
+			return headers[std::to_underlying(gateway)].generation.load(std::memory_order_acquire);
+		}
+
+		// Must be called after the payment is committed, and only once per payment. Ignored when the gateway was
+		// purged since the generation was read.
+		void add(PaymentGateway gateway, std::uint64_t generation, std::int64_t dateTime, std::int64_t amountCents);
+
+		// Returns std::nullopt when LMDB must answer instead.
+		std::optional<PaymentRepository::PaymentsGatewaySummaryResponse> getPaymentsSummary(
+			PaymentGateway gateway, std::optional<std::int64_t> from, std::optional<std::int64_t> to) const;
+
+		// Must be called inside the write transaction purging the gateway from LMDB.
+		void purge(PaymentGateway gateway);
+
+		// Makes LMDB answer the summaries of the gateway until the next purge.
+		void invalidate(PaymentGateway gateway);
+
+	private:
+		static std::size_t getSharedSize(std::uint64_t capacity)
+		{
+			return PREFIX_SIZE +
+				(sizeof(Header) + sizeof(std::int64_t) * 2 * capacity) * std::to_underlying(PaymentGateway::SIZE);
+		}
+
+		static std::int64_t sumAmounts(const std::int64_t* amountsCents, std::size_t count);
+
+		void rebuild();
+		void lock(Header& header);
+		void unlock(Header& header);
+
+		std::int64_t* getDateTimes(PaymentGateway gateway) const
+		{
+			return columns + std::to_underlying(gateway) * 2 * capacity;
+		}
+
+		std::int64_t* getAmountsCents(PaymentGateway gateway) const
+		{
+			return getDateTimes(gateway) + capacity;
+		}
+
+	private:
+		static inline constexpr unsigned READ_ATTEMPTS = 16;
+		static inline constexpr std::size_t PREFIX_SIZE = 64;  // capacity, padded to a cache line
+
+	private:
+		std::unique_ptr<SharedMemorySegment> segment;
+		Header* headers;
+		std::int64_t* columns;
+		std::uint64_t capacity;
+	};
+}  // namespace rinhaback::api
@@ -1,8 +1,15 @@
 #include "./PaymentProcessor.h"
+#include "./CircuitBreaker.h"
+#include "./ConcurrencyLimiter.h"
 #include "./Config.h"
 #include "./GatewayChooserService.h"
+#include "./ProcessorClientPool.h"
 #include "./SignalHandling.h"
+#include "./Tracing.h"
 #include "./Util.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <format>
 #include <print>
 #include <string>
@@ -13,16 +20,31 @@
 
 namespace rinhaback::api
 {
-	std::jthread PaymentProcessor::start(
-		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue, std::shared_ptr<PaymentService> paymentService)
+	std::jthread PaymentProcessor::start(std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue,
+		std::shared_ptr<RetryScheduler> retryScheduler, std::shared_ptr<PaymentService> paymentService)
 	{
 		const auto processor = std::make_shared<PaymentProcessor>();
 		processor->pendingPaymentsQueue = std::move(pendingPaymentsQueue);
+		processor->retryScheduler = std::move(retryScheduler);
 		processor->paymentService = std::move(paymentService);
 
 		return std::jthread([processor]() { processor->handler(); });
 	}
 
+	std::size_t PaymentProcessor::formatPaymentRequest(
+		std::span<char> buffer, const PendingPaymentsQueue::Payment& payment, DateTimeMillis requestedAt)
+	{
+		std::array<char, DATE_TIME_FORMATTED_LENGTH> requestedAtStr;
+		formatDateTime(requestedAt, requestedAtStr.data());
+
+		const auto formatResult = std::format_to_n(buffer.begin(), buffer.size(),
+			R"({{"correlationId":"{}","amount":{:.2f},"requestedAt":"{}"}})",
+			std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
+			std::string_view(requestedAtStr.data(), requestedAtStr.size()));
+
+		return std::min(static_cast<std::size_t>(formatResult.size), buffer.size());
+	}
+
 	void PaymentProcessor::handler()
 	{
 		std::println("PaymentProcessor started.");
@@ -46,76 +68,82 @@ namespace rinhaback::api
 				std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
 		}
 
-		std::optional<httplib::Client> httpClient;
-		const std::string* url = nullptr;
+		const auto permit = CircuitBreaker::acquire(GatewayChooserService::getGateway());
 
-		do
+		// Both gateways are refusing payments.
+		if (!permit.has_value())
 		{
-			const auto gateway = GatewayChooserService::getGateway();
-			const std::string* oldUrl = url;
+			retryScheduler->schedule(payment);
+			return;
+		}
 
-			switch (gateway)
-			{
-				case PaymentGateway::DEFAULT:
-					url = &Config::processorDefaultUrl;
-					break;
+		const auto gateway = permit->gateway;
+		auto& limiter = ConcurrencyLimiter::get(gateway);
 
-				case PaymentGateway::FALLBACK:
-					url = &Config::processorFallbackUrl;
-					break;
+		if (!limiter.acquire(LIMITER_WAIT_TIME))
+		{
+			CircuitBreaker::release(permit.value(), CircuitBreaker::Outcome::NEUTRAL);
+			retryScheduler->schedule(payment);
+			return;
+		}
 
-				default:
-					assert(false);
-					break;
-			}
+		auto httpClient = ProcessorClientPool::get(gateway).acquire();
 
-			if (!oldUrl || url != oldUrl)
-			{
-				httpClient = httplib::Client(*url);
-				httpClient->set_keep_alive(true);
-			}
+		const auto requestedAt = getCurrentDateTime();
 
-			const auto requestedAt = getCurrentDateTime();
+		std::array<char, 2000> json;
+		const auto jsonLength = formatPaymentRequest(json, payment, requestedAt);
 
-			std::array<char, 2000> json;
-			const auto jsonFormatResult = std::format_to_n(json.begin(), json.size(),
-				R"({{"correlationId":"{}","amount":{:.2f},"requestedAt":"{:%FT%T}Z"}})",
-				std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
-				requestedAt);
+		const auto sentAt = std::chrono::steady_clock::now();
+		const auto httpResponse = httpClient->Post("/payments", json.data(), jsonLength, HTTP_CONTENT_TYPE_JSON);
+		const int httpStatus = httpResponse ? httpResponse->status : -1;
 
-			const auto httpResponse =
-				httpClient->Post("/payments", json.data(), jsonFormatResult.size, HTTP_CONTENT_TYPE_JSON);
-			const int httpStatus = httpResponse ? httpResponse->status : -1;
+		const bool failed = httpStatus == -1 || (httpStatus >= 500 && httpStatus <= 599);
 
-			if (httpStatus == HTTP_STATUS_OK)
-			{
-				if constexpr (false)
-				{
-					std::println("Payment processed successfully: correlationId: {}, amount: {}",
-						std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
-				}
+		const auto latency =
+			std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sentAt);
 
-				paymentService->postPayment(gateway, payment.amount, payment.correlationId, requestedAt);
+		limiter.complete(latency, failed);
 
-				return;
+		if (Tracing::isEnabled())
+		{
+			Tracing::record(Tracing::Stage::UPSTREAM_CALL, payment.correlationId, toSteadyNanos(sentAt),
+				getSteadyNanos(), gateway, httpStatus);
+		}
+
+		GatewayChooserService::reportPayment(gateway, latency, failed);
+
+		if (httpStatus == HTTP_STATUS_OK)
+			CircuitBreaker::release(permit.value(), CircuitBreaker::Outcome::SUCCESS);
+		else
+		{
+			CircuitBreaker::release(
+				permit.value(), failed ? CircuitBreaker::Outcome::FAILURE : CircuitBreaker::Outcome::NEUTRAL);
+		}
+
+		if (!httpResponse)
+			httpClient.markBroken();
+
+		if (httpStatus == HTTP_STATUS_OK)
+		{
+			if constexpr (false)
+			{
+				std::println("Payment processed successfully: correlationId: {}, amount: {}",
+					std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
 			}
-			else
+
+			paymentService->postPayment(gateway, payment.amount, payment.correlationId, requestedAt);
+		}
+		else if (failed)
+			retryScheduler->schedule(payment);
+		else
+		{
+			if constexpr (false)
 			{
-				if (!(httpStatus == -1 || (httpStatus >= 500 && httpStatus <= 599)))
-				{
-					GatewayChooserService::switchGatewayTo(
-						gateway == PaymentGateway::DEFAULT ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT);
-
-					if constexpr (false)
-					{
-						std::println("Payment processing failed: correlationId: {}, amount: {}, httpStatus: {}",
-							std::string_view(payment.correlationId.data(), payment.correlationId.size()),
-							payment.amount, httpStatus);
-					}
-
-					break;
-				}
+				std::println("Payment processing failed: correlationId: {}, amount: {}, httpStatus: {}",
+					std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
+					httpStatus);
 			}
-		} while (true);
+		}
 	}
 }  // namespace rinhaback::api
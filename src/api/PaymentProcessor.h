@@ -2,8 +2,13 @@
 
 #include "./PaymentService.h"
 #include "./PendingPaymentsQueue.h"
+#include "./RetryScheduler.h"
+#include "./Util.h"
+#include <chrono>
 #include <memory>
+#include <span>
 #include <thread>
+#include <cstddef>
 
 
 namespace rinhaback::api
@@ -17,15 +22,23 @@ namespace rinhaback::api
 		PaymentProcessor& operator=(const PaymentProcessor&) = delete;
 
 	public:
-		static std::jthread start(
-			std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue, std::shared_ptr<PaymentService> paymentService);
+		static std::jthread start(std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue,
+			std::shared_ptr<RetryScheduler> retryScheduler, std::shared_ptr<PaymentService> paymentService);
+
+		// Formats the upstream POST /payments body, returning its length.
+		static std::size_t formatPaymentRequest(
+			std::span<char> buffer, const PendingPaymentsQueue::Payment& payment, DateTimeMillis requestedAt);
 
 	private:
 		void handler();
 		void processPayment(const PendingPaymentsQueue::Payment& payment);
 
+	private:
+		static inline constexpr std::chrono::milliseconds LIMITER_WAIT_TIME{100};
+
 	private:
 		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
+		std::shared_ptr<RetryScheduler> retryScheduler;
 		std::shared_ptr<PaymentService> paymentService;
 	};
 }  // namespace rinhaback::api
@@ -10,33 +10,139 @@
 
 namespace rinhaback::api
 {
-	void PaymentRepository::postPayment(double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt)
+	bool PaymentRepository::postPayment(
+		Transaction& transaction, double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt)
 	{
-		Connection& connection = getConnection();
+		Connection& connection = transaction.connection;
+		const auto gatewayIndex = std::to_underlying(gateway);
+		const std::int64_t dateTime = requestedAt.time_since_epoch().count();
+		const auto amountCents = toCents(amount);
+
+		// The ids DBI never has deletions, so its entries count numbers the payments.
+		MDB_stat idStat;
+		checkMdbError(mdb_stat(transaction.txn, connection.idDbis[gatewayIndex], &idStat));
+
+		auto idKey = packCorrelationId(correlationId);
+		PaymentIdData idData{.dateTime = dateTime, .sequence = idStat.ms_entries};
+
+		MDB_val mdbIdKey(sizeof(idKey), idKey.data());
+		MDB_val mdbIdData(sizeof(idData), &idData);
+		const int rc =
+			mdb_put(transaction.txn, connection.idDbis[gatewayIndex], &mdbIdKey, &mdbIdData, MDB_NOOVERWRITE);
 
-		PaymentKey key;
-		key.dateTime = requestedAt.time_since_epoch().count();
+		// Same payment stored twice, the bucket already accounts for it.
+		if (rc == MDB_KEYEXIST)
+			return false;
 
-		PaymentData data{.amount = amount, .correlationId = correlationId};
+		checkMdbError(rc);
 
-		Transaction transaction(connection, 0);
+		PaymentKey key{.dateTime = dateTime};
+		PaymentData data{.amountCents = amountCents, .sequence = idData.sequence};
 
 		MDB_val mdbKey(sizeof(key), &key);
 		MDB_val mdbData(sizeof(data), &data);
-		checkMdbError(mdb_put(transaction.txn, connection.dbis[std::to_underlying(gateway)], &mdbKey, &mdbData, 0));
+		checkMdbError(mdb_put(transaction.txn, connection.dbis[gatewayIndex], &mdbKey, &mdbData, MDB_NODUPDATA));
+
+		PaymentKey bucketKey{.dateTime = alignToBucket(dateTime)};
+		PaymentBucketData bucketData{.totalRequests = 0, .totalAmountCents = 0};
+
+		MDB_val mdbBucketKey(sizeof(bucketKey), &bucketKey);
+		MDB_val mdbBucketData;
+
+		if (const int getRc =
+				mdb_get(transaction.txn, connection.bucketDbis[gatewayIndex], &mdbBucketKey, &mdbBucketData);
+			getRc == 0)
+		{
+			std::memcpy(&bucketData, mdbBucketData.mv_data, sizeof(bucketData));
+		}
+		else if (getRc != MDB_NOTFOUND)
+			checkMdbError(getRc);
+
+		++bucketData.totalRequests;
+		bucketData.totalAmountCents += amountCents;
+
+		mdbBucketData = MDB_val(sizeof(bucketData), &bucketData);
+		checkMdbError(
+			mdb_put(transaction.txn, connection.bucketDbis[gatewayIndex], &mdbBucketKey, &mdbBucketData, 0));
+
+		return true;
+	}
+
+	PaymentRepository::PaymentIdKey PaymentRepository::packCorrelationId(const CorrelationId& correlationId)
+	{
+		const auto hexValue = [](char c)
+		{ return static_cast<std::uint8_t>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10); };
+
+		PaymentIdKey key;
+		unsigned nibble = 0;
+
+		for (const auto c : correlationId)
+		{
+			if (c == '-')
+				continue;
+
+			if (nibble % 2 == 0)
+				key[nibble / 2] = static_cast<std::uint8_t>(hexValue(c) << 4);
+			else
+				key[nibble / 2] |= hexValue(c);
+
+			++nibble;
+		}
+
+		return key;
+	}
+
+	std::int64_t PaymentRepository::sumAmounts(const PaymentData* data, std::size_t count)
+	{
+		std::int64_t sum = 0;
+
+		for (std::size_t i = 0; i < count; ++i)
+			sum += data[i].amountCents;
+
+		return sum;
 	}
 
 	PaymentRepository::PaymentsGatewaySummaryResponse PaymentRepository::getPaymentsSummary(
 		Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
 	{
-		Connection& connection = transaction.connection;
-
 		PaymentsGatewaySummaryResponse response = {
 			.totalRequests = 0,
-			.totalAmount = 0.0,
+			.totalAmountCents = 0,
 		};
 
-		PaymentKey initialKey{.dateTime = from.value_or(0)};
+		const std::int64_t fromValue = from.value_or(0);
+
+		if (to.has_value() && fromValue > to.value())
+			return response;
+
+		// Whole buckets are in [firstBucket, endBucket), the partial edges are scanned payment by payment.
+		const std::int64_t firstBucket = alignToBucket(fromValue + BUCKET_MILLIS - 1);
+		const std::optional<std::int64_t> endBucket =
+			to.has_value() ? std::make_optional(alignToBucket(to.value() + 1)) : std::nullopt;
+
+		if (endBucket.has_value() && firstBucket >= endBucket.value())
+		{
+			summarizePayments(transaction, fromValue, to, response);
+			return response;
+		}
+
+		if (fromValue < firstBucket)
+			summarizePayments(transaction, fromValue, firstBucket - 1, response);
+
+		summarizeBuckets(transaction, firstBucket, endBucket, response);
+
+		if (endBucket.has_value() && endBucket.value() <= to.value())
+			summarizePayments(transaction, endBucket.value(), to, response);
+
+		return response;
+	};
+
+	void PaymentRepository::summarizePayments(Transaction& transaction, std::int64_t from,
+		std::optional<std::int64_t> to, PaymentsGatewaySummaryResponse& response)
+	{
+		Connection& connection = transaction.connection;
+
+		PaymentKey initialKey{.dateTime = from};
 
 		MDB_val mdbKey(sizeof(initialKey), &initialKey);
 		MDB_val mdbData;
@@ -44,31 +150,74 @@ namespace rinhaback::api
 		MDB_cursor* cursor;
 		checkMdbError(mdb_cursor_open(transaction.txn, connection.dbis[std::to_underlying(gateway)], &cursor));
 
-		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, (from ? MDB_SET_RANGE : MDB_FIRST));
+		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_SET_RANGE);
 
-		if (rc != 0)
+		while (rc == 0)
 		{
-			mdb_cursor_close(cursor);
+			const auto* key = static_cast<const PaymentKey*>(mdbKey.mv_data);
+
+			if (to.has_value() && key->dateTime > to.value())
+			{
+				rc = MDB_NOTFOUND;
+				break;
+			}
+
+			// Fetch the key duplicates a page at a time. For keys with a single payment, MDB_GET_MULTIPLE
+			// leaves mdbData pointing to the record already read.
+			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_GET_MULTIPLE);
+
+			while (rc == 0)
+			{
+				const auto count = mdbData.mv_size / sizeof(PaymentData);
+
+				response.totalRequests += count;
+				response.totalAmountCents += sumAmounts(static_cast<const PaymentData*>(mdbData.mv_data), count);
+
+				rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT_MULTIPLE);
+			}
 
 			if (rc != MDB_NOTFOUND)
-				checkMdbError(rc);
+				break;
 
-			return response;
+			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT_NODUP);
 		}
 
+		mdb_cursor_close(cursor);
+
+		if (rc != MDB_NOTFOUND)
+			checkMdbError(rc);
+	}
+
+	void PaymentRepository::summarizeBuckets(Transaction& transaction, std::int64_t from,
+		std::optional<std::int64_t> toExclusive, PaymentsGatewaySummaryResponse& response)
+	{
+		Connection& connection = transaction.connection;
+
+		PaymentKey initialKey{.dateTime = from};
+
+		MDB_val mdbKey(sizeof(initialKey), &initialKey);
+		MDB_val mdbData;
+
+		MDB_cursor* cursor;
+		checkMdbError(mdb_cursor_open(transaction.txn, connection.bucketDbis[std::to_underlying(gateway)], &cursor));
+
+		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_SET_RANGE);
+
 		while (rc == 0)
 		{
 			const auto* key = static_cast<const PaymentKey*>(mdbKey.mv_data);
-			const auto* data = static_cast<const PaymentData*>(mdbData.mv_data);
 
-			if (to.has_value() && key->dateTime > to.value())
+			if (toExclusive.has_value() && key->dateTime >= toExclusive.value())
 			{
 				rc = MDB_NOTFOUND;
 				break;
 			}
 
-			++response.totalRequests;
-			response.totalAmount += data->amount;
+			PaymentBucketData data;
+			std::memcpy(&data, mdbData.mv_data, sizeof(data));
+
+			response.totalRequests += data.totalRequests;
+			response.totalAmountCents += data.totalAmountCents;
 
 			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT);
 		}
@@ -77,15 +226,45 @@ namespace rinhaback::api
 
 		if (rc != MDB_NOTFOUND)
 			checkMdbError(rc);
+	}
 
-		return response;
-	};
+	void PaymentRepository::forEachPayment(
+		Transaction& transaction, const std::function<void(std::int64_t, std::int64_t)>& callback)
+	{
+		Connection& connection = transaction.connection;
+
+		MDB_val mdbKey;
+		MDB_val mdbData;
+
+		MDB_cursor* cursor;
+		checkMdbError(mdb_cursor_open(transaction.txn, connection.dbis[std::to_underlying(gateway)], &cursor));
+
+		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_FIRST);
+
+		while (rc == 0)
+		{
+			const auto* key = static_cast<const PaymentKey*>(mdbKey.mv_data);
+
+			PaymentData data;
+			std::memcpy(&data, mdbData.mv_data, sizeof(data));
 
-	void PaymentRepository::purge()
+			callback(key->dateTime, data.amountCents);
+
+			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT);
+		}
+
+		mdb_cursor_close(cursor);
+
+		if (rc != MDB_NOTFOUND)
+			checkMdbError(rc);
+	}
+
+	void PaymentRepository::purge(Transaction& transaction)
 	{
-		Connection& connection = getConnection();
-		Transaction transaction(connection, 0);
+		Connection& connection = transaction.connection;
 
 		checkMdbError(mdb_drop(transaction.txn, connection.dbis[std::to_underlying(gateway)], 0));
+		checkMdbError(mdb_drop(transaction.txn, connection.bucketDbis[std::to_underlying(gateway)], 0));
+		checkMdbError(mdb_drop(transaction.txn, connection.idDbis[std::to_underlying(gateway)], 0));
 	}
 }  // namespace rinhaback::api
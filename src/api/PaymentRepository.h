@@ -2,7 +2,10 @@
 
 #include "./Database.h"
 #include "./Util.h"
+#include <array>
+#include <functional>
 #include <optional>
+#include <cstddef>
 #include <cstdint>
 
 
@@ -14,7 +17,7 @@ namespace rinhaback::api
 		struct PaymentsGatewaySummaryResponse
 		{
 			unsigned totalRequests;
-			double totalAmount;
+			std::int64_t totalAmountCents;
 		};
 
 	private:
@@ -23,10 +26,28 @@ namespace rinhaback::api
 			std::int64_t dateTime;
 		};
 
+		// Duplicates of the payments DBI (storage version 2). Only what summaries read, so scans stay dense.
+		// The sequence tells apart payments of the same millisecond and amount.
 		struct __attribute__((packed)) PaymentData
 		{
-			double amount;
-			CorrelationId correlationId;
+			std::int64_t amountCents;
+			std::uint64_t sequence;
+		};
+
+		// Key of the ids DBI: the correlation id UUID packed in binary.
+		using PaymentIdKey = std::array<std::uint8_t, 16>;
+
+		struct __attribute__((packed)) PaymentIdData
+		{
+			std::int64_t dateTime;
+			std::uint64_t sequence;
+		};
+
+		// Pre-aggregated totals of all payments whose dateTime falls in [key, key + BUCKET_MILLIS).
+		struct __attribute__((packed)) PaymentBucketData
+		{
+			std::uint64_t totalRequests;
+			std::int64_t totalAmountCents;
 		};
 
 	public:
@@ -39,12 +60,38 @@ namespace rinhaback::api
 		PaymentRepository& operator=(const PaymentRepository&) = delete;
 
 	public:
-		void postPayment(double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt);
+		// Returns false when the payment was already stored.
+		bool postPayment(
+			Transaction& transaction, double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt);
 
 		PaymentsGatewaySummaryResponse getPaymentsSummary(
 			Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
 
-		void purge();
+		// Calls callback(dateTime, amountCents) for every payment, in time order.
+		void forEachPayment(
+			Transaction& transaction, const std::function<void(std::int64_t, std::int64_t)>& callback);
+
+		void purge(Transaction& transaction);
+
+	private:
+		static constexpr std::int64_t alignToBucket(std::int64_t dateTime)
+		{
+			return (dateTime / BUCKET_MILLIS - (dateTime % BUCKET_MILLIS < 0 ? 1 : 0)) * BUCKET_MILLIS;
+		}
+
+		// The correlation id must be a valid UUID (see PaymentRequestParser::isValidUuid).
+		static PaymentIdKey packCorrelationId(const CorrelationId& correlationId);
+
+		static std::int64_t sumAmounts(const PaymentData* data, std::size_t count);
+
+		void summarizePayments(Transaction& transaction, std::int64_t from, std::optional<std::int64_t> to,
+			PaymentsGatewaySummaryResponse& response);
+
+		void summarizeBuckets(Transaction& transaction, std::int64_t from, std::optional<std::int64_t> toExclusive,
+			PaymentsGatewaySummaryResponse& response);
+
+	private:
+		static inline constexpr std::int64_t BUCKET_MILLIS = 100;
 
 	private:
 		PaymentGateway gateway;
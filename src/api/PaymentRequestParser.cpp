@@ -0,0 +1,253 @@
+#include "./PaymentRequestParser.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <experimental/scope>
+#include "yyjson.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+namespace rinhaback::api
+{
+	static constexpr std::string_view CORRELATION_ID_KEY = "correlationId";
+	static constexpr std::string_view AMOUNT_KEY = "amount";
+
+	static constexpr bool isJsonWhitespace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	static constexpr bool isHexDigit(char c)
+	{
+		return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+	}
+
+	static constexpr bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	// Returns the end of the JSON number starting at pos, or nullptr when it doesn't follow the JSON grammar
+	// (from_chars also accepts forms like .5, 5., 01, inf and nan).
+	static const char* scanJsonNumber(const char* pos, const char* end)
+	{
+		const auto skipDigits = [&]
+		{
+			const auto start = pos;
+
+			while (pos < end && isDigit(*pos))
+				++pos;
+
+			return pos != start;
+		};
+
+		if (pos < end && *pos == '-')
+			++pos;
+
+		if (pos < end && *pos == '0')
+			++pos;
+		else if (!skipDigits())
+			return nullptr;
+
+		if (pos < end && *pos == '.')
+		{
+			++pos;
+
+			if (!skipDigits())
+				return nullptr;
+		}
+
+		if (pos < end && (*pos | 0x20) == 'e')
+		{
+			++pos;
+
+			if (pos < end && (*pos == '+' || *pos == '-'))
+				++pos;
+
+			if (!skipDigits())
+				return nullptr;
+		}
+
+		return pos;
+	}
+
+	std::optional<PaymentRequestParser::PaymentRequest> PaymentRequestParser::parse(std::string_view body)
+	{
+		if (const auto request = parseFast(body))
+			return request;
+
+		return parseGeneric(body);
+	}
+
+	std::optional<PaymentRequestParser::PaymentRequest> PaymentRequestParser::parseFast(std::string_view body) noexcept
+	{
+		const char* pos = body.data();
+		const char* const end = pos + body.size();
+
+		const auto skipWhitespace = [&]
+		{
+			while (pos < end && isJsonWhitespace(*pos))
+				++pos;
+		};
+
+		const auto consume = [&](char c)
+		{
+			skipWhitespace();
+
+			if (pos < end && *pos == c)
+			{
+				++pos;
+				return true;
+			}
+
+			return false;
+		};
+
+		PaymentRequest request;
+		bool hasCorrelationId = false;
+		bool hasAmount = false;
+
+		if (!consume('{'))
+			return std::nullopt;
+
+		do
+		{
+			if (!consume('"'))
+				return std::nullopt;
+
+			const auto keyEnd = std::find(pos, end, '"');
+
+			if (keyEnd == end)
+				return std::nullopt;
+
+			const std::string_view key(pos, keyEnd);
+			pos = keyEnd + 1;
+
+			if (!consume(':'))
+				return std::nullopt;
+
+			skipWhitespace();
+
+			if (key == CORRELATION_ID_KEY && !hasCorrelationId)
+			{
+				constexpr auto uuidLength = std::tuple_size<CorrelationId>();
+
+				if (end - pos < static_cast<std::ptrdiff_t>(uuidLength + 2) || pos[0] != '"' ||
+					pos[uuidLength + 1] != '"' || !isValidUuid(pos + 1))
+				{
+					return std::nullopt;
+				}
+
+				std::copy_n(pos + 1, uuidLength, request.correlationId.begin());
+				pos += uuidLength + 2;
+				hasCorrelationId = true;
+			}
+			else if (key == AMOUNT_KEY && !hasAmount)
+			{
+				const auto tokenEnd = scanJsonNumber(pos, end);
+
+				if (!tokenEnd)
+					return std::nullopt;
+
+				const auto [numberEnd, ec] = std::from_chars(pos, tokenEnd, request.amount);
+
+				if (ec != std::errc() || numberEnd != tokenEnd || !std::isfinite(request.amount))
+					return std::nullopt;
+
+				pos = numberEnd;
+				hasAmount = true;
+			}
+			else
+				return std::nullopt;
+
+			if (consume('}'))
+				break;
+
+			if (!consume(','))
+				return std::nullopt;
+		} while (true);
+
+		skipWhitespace();
+
+		if (pos != end || !hasCorrelationId || !hasAmount)
+			return std::nullopt;
+
+		return request;
+	}
+
+	std::optional<PaymentRequestParser::PaymentRequest> PaymentRequestParser::parseGeneric(std::string_view body)
+	{
+		thread_local std::array<char, 16384> poolBuffer;
+
+		yyjson_alc allocator;
+		yyjson_read_err error{};
+		yyjson_doc* docJson = nullptr;
+
+		if (yyjson_alc_pool_init(&allocator, poolBuffer.data(), poolBuffer.size()))
+			docJson = yyjson_read_opts(const_cast<char*>(body.data()), body.size(), 0, &allocator, &error);
+
+		// Too big for the pool.
+		if (!docJson && error.code == YYJSON_READ_ERROR_MEMORY_ALLOCATION)
+			docJson = yyjson_read(body.data(), body.size(), 0);
+
+		std::experimental::scope_exit scopeExit([&]() { yyjson_doc_free(docJson); });
+
+		const auto rootJson = yyjson_doc_get_root(docJson);
+		const auto correlationIdJson = yyjson_obj_get(rootJson, "correlationId");
+		const auto amountJson = yyjson_obj_get(rootJson, "amount");
+
+		if (!yyjson_is_str(correlationIdJson) || !yyjson_is_num(amountJson) ||
+			yyjson_get_len(correlationIdJson) != std::tuple_size<CorrelationId>() ||
+			!isValidUuid(yyjson_get_str(correlationIdJson)))
+		{
+			return std::nullopt;
+		}
+
+		PaymentRequest request{.amount = yyjson_get_num(amountJson)};
+		std::copy_n(yyjson_get_str(correlationIdJson), request.correlationId.size(), request.correlationId.begin());
+
+		return request;
+	}
+
+	bool PaymentRequestParser::isValidUuid(const char* str) noexcept
+	{
+#ifdef __SSE2__
+		const auto hexMask = [](__m128i chars)
+		{
+			const auto digits = _mm_and_si128(
+				_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+			const auto lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+			const auto letters = _mm_and_si128(
+				_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+			return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(digits, letters)));
+		};
+
+		const auto dashMask = [](__m128i chars)
+		{ return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('-')))); };
+
+		// Dashes are at 8, 13, 18 and 23, everything else must be hex digits.
+		constexpr unsigned dashes0 = (1u << 8) | (1u << 13);
+		constexpr unsigned dashes1 = (1u << (18 - 16)) | (1u << (23 - 16));
+
+		const auto chunk0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str));
+		const auto chunk1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + 16));
+
+		return dashMask(chunk0) == dashes0 && hexMask(chunk0) == (0xFFFFu & ~dashes0) && dashMask(chunk1) == dashes1 &&
+			hexMask(chunk1) == (0xFFFFu & ~dashes1) && isHexDigit(str[32]) && isHexDigit(str[33]) &&
+			isHexDigit(str[34]) && isHexDigit(str[35]);
+#else
+		for (unsigned i = 0; i < std::tuple_size<CorrelationId>(); ++i)
+		{
+			if (i == 8 || i == 13 || i == 18 || i == 23 ? str[i] != '-' : !isHexDigit(str[i]))
+				return false;
+		}
+
+		return true;
+#endif
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "./Database.h"
+#include <optional>
+#include <string_view>
+
+
+namespace rinhaback::api
+{
+	// Parser of the POST /payments body: {"correlationId": "<uuid>", "amount": <number>}.
+	class PaymentRequestParser final
+	{
+	public:
+		struct PaymentRequest
+		{
+			CorrelationId correlationId;
+			double amount;
+		};
+
+	public:
+		PaymentRequestParser() = delete;
+
+	public:
+		// Returns std::nullopt for invalid requests.
+		static std::optional<PaymentRequest> parse(std::string_view body);
+
+		// Allocation-free parser of the expected schema only (any key order and whitespace, no escapes nor
+		// other keys). Returns std::nullopt for anything else, which may still be a valid request.
+		static std::optional<PaymentRequest> parseFast(std::string_view body) noexcept;
+
+		// yyjson parser, with a per-thread pooled allocator.
+		static std::optional<PaymentRequest> parseGeneric(std::string_view body);
+
+		// Validates the 8-4-4-4-12 hexadecimal format. The 36 chars must be readable.
+		static bool isValidUuid(const char* str) noexcept;
+	};
+}  // namespace rinhaback::api
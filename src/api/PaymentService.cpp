@@ -1,14 +1,86 @@
 #include "./PaymentService.h"
+#include "./Config.h"
+#include "./Futex.h"
+#include "./Metrics.h"
+#include "./PaymentMirror.h"
+#include "./SharedMemory.h"
+#include "./Tracing.h"
 #include "./Util.h"
+#include <algorithm>
+#include <exception>
+#include <print>
+#include <string_view>
+#include <cerrno>
+#include <climits>
 
 
 namespace rinhaback::api
 {
+	std::jthread PaymentService::start(std::shared_ptr<PaymentService> paymentService)
+	{
+		if (!isGroupCommitEnabled())
+			return {};
+
+		return std::jthread([paymentService](std::stop_token stopToken)
+			{ paymentService->commitHandler(std::move(stopToken)); });
+	}
+
 	void PaymentService::postPayment(
 		PaymentGateway gateway, double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt)
 	{
-		auto& repository = repositories[std::to_underlying(gateway)];
-		repository.postPayment(amount, correlationId, requestedAt);
+		Metrics::increment(Metrics::forGateway(Metrics::Counter::PAYMENTS_PROCESSED_DEFAULT, gateway));
+
+		const auto acknowledgedAt = Tracing::isEnabled() ? getSteadyNanos() : 0;
+
+		if (!isGroupCommitEnabled())
+		{
+			const auto mirror = PaymentMirror::get();
+			bool stored = false;
+			std::uint64_t mirrorGeneration = 0;
+
+			{  // scope
+				const Metrics::Timer timer(Metrics::Histogram::WRITE_TRANSACTION);
+				auto& repository = repositories[std::to_underlying(gateway)];
+
+				writeTransaction(getConnection(),
+					[&](Transaction& transaction)
+					{
+						if (mirror)
+							mirrorGeneration = mirror->getGeneration(gateway);
+
+						stored = repository.postPayment(transaction, amount, correlationId, requestedAt);
+					});
+			}
+
+			if (mirror && stored)
+				mirror->add(gateway, mirrorGeneration, requestedAt.time_since_epoch().count(), toCents(amount));
+
+			if (Tracing::isEnabled())
+				Tracing::record(Tracing::Stage::COMMIT, correlationId, acknowledgedAt, getSteadyNanos(), gateway);
+
+			return;
+		}
+
+		bool notify;
+
+		{  // scope
+			std::unique_lock lock(commitMutex);
+
+			pendingCommits.push_back(PendingCommit{
+				.gateway = gateway,
+				.amount = amount,
+				.correlationId = correlationId,
+				.requestedAt = requestedAt,
+				.acknowledgedAt = acknowledgedAt,
+			});
+
+			++getSharedData().instances[Config::instanceId].acknowledgedPayments;
+
+			notify = pendingCommits.size() == 1 || pendingCommits.size() >= Config::commitBatchSize;
+		}
+
+		if (notify)
+			commitCondVar.notify_one();
 	}
 
 	PaymentService::PaymentsSummaryResponse PaymentService::getPaymentsSummary(
@@ -19,22 +91,361 @@ namespace rinhaback::api
 		const std::optional<std::int64_t> toInt =
 			to.has_value() ? std::make_optional(to->time_since_epoch().count()) : std::nullopt;
 
+		const Metrics::Timer timer(Metrics::Histogram::SUMMARY_SCAN);
+
+		flushPayments();
+
+		std::optional<PaymentRepository::PaymentsGatewaySummaryResponse> defaultGateway, fallbackGateway;
+
+		if (const auto mirror = PaymentMirror::get())
+		{
+			defaultGateway = mirror->getPaymentsSummary(PaymentGateway::DEFAULT, fromInt, toInt);
+			fallbackGateway = mirror->getPaymentsSummary(PaymentGateway::FALLBACK, fromInt, toInt);
+
+			if (defaultGateway.has_value() && fallbackGateway.has_value())
+				return PaymentsSummaryResponse{.defaultGateway = *defaultGateway, .fallbackGateway = *fallbackGateway};
+		}
+
 		Connection& connection = getConnection();
 		Transaction transaction(connection, MDB_RDONLY);
 
 		PaymentsSummaryResponse response{
-			.defaultGateway = repositories[std::to_underlying(PaymentGateway::DEFAULT)].getPaymentsSummary(
-				transaction, fromInt, toInt),
-			.fallbackGateway = repositories[std::to_underlying(PaymentGateway::FALLBACK)].getPaymentsSummary(
-				transaction, fromInt, toInt),
+			.defaultGateway = defaultGateway.has_value()
+				? *defaultGateway
+				: getPaymentsSummary(transaction, PaymentGateway::DEFAULT, fromInt, toInt),
+			.fallbackGateway = fallbackGateway.has_value()
+				? *fallbackGateway
+				: getPaymentsSummary(transaction, PaymentGateway::FALLBACK, fromInt, toInt),
 		};
 
 		return response;
 	};
 
+	PaymentRepository::PaymentsGatewaySummaryResponse PaymentService::getPaymentsSummary(Transaction& transaction,
+		PaymentGateway gateway, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		return repositories[std::to_underlying(gateway)].getPaymentsSummary(transaction, from, to);
+	}
+
 	void PaymentService::purge()
 	{
-		repositories[std::to_underlying(PaymentGateway::DEFAULT)].purge();
-		repositories[std::to_underlying(PaymentGateway::FALLBACK)].purge();
+		std::unique_lock<std::mutex> batchLock;
+
+		if (isGroupCommitEnabled())
+		{
+			// Wait for the batch being committed, which is dropped later if it was taken before the purge.
+			batchLock = std::unique_lock(batchMutex);
+
+			std::unique_lock lock(commitMutex);
+
+			// Dropped payments will never be committed, so count them as such for flushPayments.
+			countCommitted(pendingCommits.size());
+			pendingCommits.clear();
+			++commitGeneration;
+		}
+
+		const auto mirror = PaymentMirror::get();
+
+		try
+		{
+			writeTransaction(getConnection(),
+				[&](Transaction& transaction)
+				{
+					for (auto& repository : repositories)
+						repository.purge(transaction);
+
+					// While holding the LMDB write lock, so it's ordered with the commits of all the instances.
+					if (mirror)
+					{
+						mirror->purge(PaymentGateway::DEFAULT);
+						mirror->purge(PaymentGateway::FALLBACK);
+					}
+				});
+		}
+		catch (...)
+		{
+			// The mirror may have been purged while LMDB was not.
+			if (mirror)
+			{
+				mirror->invalidate(PaymentGateway::DEFAULT);
+				mirror->invalidate(PaymentGateway::FALLBACK);
+			}
+
+			throw;
+		}
+	}
+
+	void PaymentService::commitHandler(std::stop_token stopToken)
+	{
+		std::println("PaymentService committer started.");
+
+		std::vector<PendingCommit> batch;
+		batch.reserve(Config::commitBatchSize);
+		std::uint64_t generation = 0;
+
+		do
+		{
+			{  // scope
+				std::unique_lock lock(commitMutex);
+
+				if (!commitCondVar.wait(lock, stopToken, [&] { return !pendingCommits.empty(); }))
+					break;
+
+				// Give other payments a chance to join the batch.
+				commitCondVar.wait_for(lock, stopToken, Config::commitMaxWait,
+					[&] { return pendingCommits.size() >= Config::commitBatchSize || flushRequested; });
+
+				const auto count = std::min<std::size_t>(pendingCommits.size(), Config::commitBatchSize);
+				batch.assign(pendingCommits.begin(), pendingCommits.begin() + count);
+				pendingCommits.erase(pendingCommits.begin(), pendingCommits.begin() + count);
+				generation = commitGeneration;
+
+				if (pendingCommits.empty())
+					flushRequested = false;
+			}
+
+			bool requeued;
+
+			{  // scope
+				std::unique_lock batchLock(batchMutex);
+				requeued = commitOrRequeue(batch, generation);
+			}
+
+			if (requeued)
+			{
+				std::unique_lock lock(commitMutex);
+				commitCondVar.wait_for(lock, stopToken, COMMIT_RETRY_DELAY, [] { return false; });
+			}
+
+			batch.clear();
+		} while (true);
+
+		// Stop was requested, but payments may still be pending.
+		std::unique_lock batchLock(batchMutex);
+		std::unique_lock lock(commitMutex);
+		batch.swap(pendingCommits);
+		lock.unlock();
+
+		if (commitBatch(batch) != CommitResult::COMMITTED)
+			commitIndividually(batch);
+
+		std::println("PaymentService committer stopped.");
+	}
+
+	bool PaymentService::commitOrRequeue(std::vector<PendingCommit>& batch, std::uint64_t generation)
+	{
+		{  // scope
+			std::unique_lock lock(commitMutex);
+
+			// Taken before a purge, so it must not come back.
+			if (generation != commitGeneration)
+			{
+				countCommitted(batch.size());
+				return false;
+			}
+		}
+
+		switch (commitBatch(batch))
+		{
+			case CommitResult::COMMITTED:
+				return false;
+
+			case CommitResult::TRANSIENT_FAILURE:
+				if (std::ranges::max(batch, {}, &PendingCommit::attempts).attempts + 1 < COMMIT_MAX_ATTEMPTS)
+				{
+					for (auto& payment : batch)
+						++payment.attempts;
+
+					std::unique_lock lock(commitMutex);
+
+					// The payments were acknowledged to the processors, so they are retried ahead of the newer ones.
+					pendingCommits.insert(pendingCommits.begin(), batch.begin(), batch.end());
+
+					return true;
+				}
+
+				break;
+
+			case CommitResult::PERMANENT_FAILURE:
+				break;
+		}
+
+		// Don't let a bad payment (or a full database) hold the later commits back forever.
+		commitIndividually(batch);
+
+		return false;
+	}
+
+	void PaymentService::commitIndividually(const std::vector<PendingCommit>& batch)
+	{
+		std::vector<PendingCommit> single(1);
+
+		for (const auto& payment : batch)
+		{
+			single[0] = payment;
+
+			if (batch.size() > 1 && commitBatch(single) == CommitResult::COMMITTED)
+				continue;
+
+			std::println(stderr, "Acknowledged payment {} dropped after failing to commit.",
+				std::string_view(payment.correlationId.data(), payment.correlationId.size()));
+			Metrics::increment(Metrics::Counter::COMMITS_DROPPED);
+
+			// Never to be committed, so count it as such for flushPayments.
+			countCommitted(1);
+		}
+	}
+
+	static bool isTransientError(int code)
+	{
+		switch (code)
+		{
+			case MDB_MAP_RESIZED:
+			case MDB_READERS_FULL:
+			case EAGAIN:
+			case EBUSY:
+			case EINTR:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	PaymentService::CommitResult PaymentService::commitBatch(std::vector<PendingCommit>& batch)
+	{
+		if (batch.empty())
+			return CommitResult::COMMITTED;
+
+		const auto mirror = PaymentMirror::get();
+
+		try
+		{
+			const Metrics::Timer timer(Metrics::Histogram::WRITE_TRANSACTION);
+
+			writeTransaction(getConnection(),
+				[&](Transaction& transaction)
+				{
+					for (auto& payment : batch)
+					{
+						if (mirror)
+							payment.mirrorGeneration = mirror->getGeneration(payment.gateway);
+
+						payment.stored = repositories[std::to_underlying(payment.gateway)].postPayment(
+							transaction, payment.amount, payment.correlationId, payment.requestedAt);
+					}
+				});
+		}
+		catch (const MdbError& e)
+		{
+			std::println(stderr, "Commit of {} payments failed: {}", batch.size(), e.what());
+			Metrics::increment(Metrics::Counter::COMMIT_FAILURES);
+
+			return isTransientError(e.code) ? CommitResult::TRANSIENT_FAILURE : CommitResult::PERMANENT_FAILURE;
+		}
+		catch (const std::exception& e)
+		{
+			std::println(stderr, "Commit of {} payments failed: {}", batch.size(), e.what());
+			Metrics::increment(Metrics::Counter::COMMIT_FAILURES);
+
+			return CommitResult::PERMANENT_FAILURE;
+		}
+
+		// Before counting the batch as committed, so flushPayments also waits for the mirror.
+		if (mirror)
+		{
+			for (const auto& payment : batch)
+			{
+				if (payment.stored)
+				{
+					mirror->add(payment.gateway, payment.mirrorGeneration,
+						payment.requestedAt.time_since_epoch().count(), toCents(payment.amount));
+				}
+			}
+		}
+
+		countCommitted(batch.size());
+
+		if (Tracing::isEnabled())
+		{
+			const auto committedAt = getSteadyNanos();
+
+			for (const auto& payment : batch)
+			{
+				Tracing::record(Tracing::Stage::COMMIT, payment.correlationId, payment.acknowledgedAt, committedAt,
+					payment.gateway);
+			}
+		}
+
+		return CommitResult::COMMITTED;
+	}
+
+	void PaymentService::flushPayments()
+	{
+		if (!isGroupCommitEnabled())
+			return;
+
+		auto& sharedData = getSharedData();
+		std::uint64_t targets[SharedData::MAX_INSTANCES];
+
+		for (unsigned i = 0; i < SharedData::MAX_INSTANCES; ++i)
+			targets[i] = sharedData.instances[i].acknowledgedPayments.load();
+
+		{  // scope
+			std::unique_lock lock(commitMutex);
+
+			if (!pendingCommits.empty())
+				flushRequested = true;
+		}
+
+		commitCondVar.notify_one();
+
+		// Other instances flush by themselves at most COMMIT_MAX_WAIT_US after a payment.
+		// The timeout protects summaries from a dead instance.
+		const auto deadline = std::chrono::steady_clock::now() + FLUSH_TIMEOUT;
+
+		for (unsigned i = 0; i < SharedData::MAX_INSTANCES; ++i)
+		{
+			auto& instance = sharedData.instances[i];
+
+			// A dead instance will not commit its pending payments, so don't wait for them.
+			if (i != Config::instanceId && !instance.isAlive())
+				continue;
+
+			while (instance.committedPayments.load() < targets[i])
+			{
+				const auto remaining = deadline - std::chrono::steady_clock::now();
+
+				if (remaining <= std::chrono::nanoseconds::zero())
+				{
+					std::println(stderr, "Summary answered without {} payments of instance {} committed.",
+						targets[i] - instance.committedPayments.load(), i);
+					Metrics::increment(Metrics::Counter::SUMMARY_FLUSH_TIMEOUTS);
+					return;
+				}
+
+				const auto epoch = instance.commitEpoch.load(std::memory_order_acquire);
+				instance.commitWaiters.fetch_add(1, std::memory_order_seq_cst);
+
+				if (instance.committedPayments.load() < targets[i])
+					Futex::wait(instance.commitEpoch, epoch, remaining, true);
+
+				instance.commitWaiters.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void PaymentService::countCommitted(std::uint64_t count)
+	{
+		auto& instance = getSharedData().instances[Config::instanceId];
+
+		instance.committedPayments += count;
+		instance.commitEpoch.fetch_add(1, std::memory_order_release);
+
+		// Pairs with the seq_cst increment of commitWaiters in flushPayments.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (instance.commitWaiters.load(std::memory_order_relaxed) != 0)
+			Futex::wake(instance.commitEpoch, INT_MAX, true);
 	}
 }  // namespace rinhaback::api
@@ -1,10 +1,19 @@
 #pragma once
 
+#include "./Config.h"
 #include "./Database.h"
 #include "./PaymentRepository.h"
 #include "./Util.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <stop_token>
+#include <thread>
 #include <utility>
+#include <vector>
+#include <cstdint>
 
 
 namespace rinhaback::api
@@ -18,6 +27,26 @@ namespace rinhaback::api
 			PaymentRepository::PaymentsGatewaySummaryResponse fallbackGateway;
 		};
 
+	private:
+		enum class CommitResult
+		{
+			COMMITTED,
+			TRANSIENT_FAILURE,
+			PERMANENT_FAILURE
+		};
+
+		struct PendingCommit
+		{
+			PaymentGateway gateway;
+			double amount;
+			CorrelationId correlationId;
+			DateTimeMillis requestedAt;
+			std::int64_t acknowledgedAt;  // steady clock nanoseconds, only when tracing
+			bool stored = false;  // set by commitBatch, false for duplicates
+			std::uint64_t mirrorGeneration = 0;  // set by commitBatch, see PaymentMirror::getGeneration
+			unsigned attempts = 0;  // failed commits of the batches it was part of
+		};
+
 	public:
 		PaymentService() = default;
 
@@ -26,6 +55,9 @@ namespace rinhaback::api
 
 
 	public:
+		// Starts the group commit thread, when COMMIT_BATCH_SIZE > 1.
+		static std::jthread start(std::shared_ptr<PaymentService> paymentService);
+
 		void postPayment(
 			PaymentGateway gateway, double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt);
 		PaymentsSummaryResponse getPaymentsSummary(
@@ -33,8 +65,49 @@ namespace rinhaback::api
 
 		void purge();
 
+	private:
+		static bool isGroupCommitEnabled()
+		{
+			return Config::commitBatchSize > 1;
+		}
+
+		void commitHandler(std::stop_token stopToken);
+
+		// Commits a batch taken at the given purge generation, with batchMutex locked.
+		// Returns true when it was requeued after a transient failure.
+		bool commitOrRequeue(std::vector<PendingCommit>& batch, std::uint64_t generation);
+
+		// The batch is counted as committed only when COMMITTED is returned.
+		CommitResult commitBatch(std::vector<PendingCommit>& batch);
+
+		// Commits each payment in its own transaction, dropping the ones which still fail.
+		void commitIndividually(const std::vector<PendingCommit>& batch);
+
+		// Adds count to the committed payments of this instance and wakes the flushPayments waiting for them.
+		void countCommitted(std::uint64_t count);
+
+		// Waits until the payments acknowledged by all instances up to now are committed.
+		void flushPayments();
+
+		PaymentRepository::PaymentsGatewaySummaryResponse getPaymentsSummary(Transaction& transaction,
+			PaymentGateway gateway, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+
+	private:
+		static inline constexpr std::chrono::milliseconds FLUSH_TIMEOUT{100};
+		static inline constexpr std::chrono::milliseconds COMMIT_RETRY_DELAY{10};
+		static inline constexpr unsigned COMMIT_MAX_ATTEMPTS = 5;
+
 	private:
 		PaymentRepository repositories[std::to_underlying(PaymentGateway::SIZE)] = {
 			{PaymentGateway::DEFAULT}, {PaymentGateway::FALLBACK}};
+
+		std::mutex commitMutex;
+		std::condition_variable_any commitCondVar;
+		std::vector<PendingCommit> pendingCommits;
+		bool flushRequested = false;
+		std::uint64_t commitGeneration = 0;  // incremented by purge, guarded by commitMutex
+
+		// Held while a taken batch is committed or requeued, so purge waits for it.
+		std::mutex batchMutex;
 	};
 }  // namespace rinhaback::api
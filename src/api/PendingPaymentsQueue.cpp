@@ -0,0 +1,178 @@
+#include "./PendingPaymentsQueue.h"
+#include "./Config.h"
+#include "./SharedMemory.h"
+#include <new>
+#include <print>
+#include <utility>
+#include <cstddef>
+
+
+namespace rinhaback::api
+{
+	static constexpr const char* SHARED_QUEUE_NAME = "PendingPaymentsQueue";
+
+	static_assert(PendingPaymentsQueue::MAX_INSTANCES == SharedData::MAX_INSTANCES);
+
+	PendingPaymentsQueue::PendingPaymentsQueue(unsigned capacity)
+		: ownedHeader(std::make_unique<Header>()),
+		  ownedCells(std::make_unique<Cell[]>(std::bit_ceil(std::max(capacity, 2u)))),
+		  shared(false)
+	{
+		initialize(ownedHeader.get(), ownedCells.get(), capacity);
+	}
+
+	PendingPaymentsQueue::PendingPaymentsQueue(std::unique_ptr<SharedMemorySegment> segment)
+		: segment(std::move(segment)),
+		  shared(true)
+	{
+		const auto address = static_cast<std::byte*>(this->segment->getAddress());
+		const auto sharedHeader = reinterpret_cast<Header*>(address);
+		const auto sharedCells = reinterpret_cast<Cell*>(address + sizeof(Header));
+
+		if (Config::databaseInit)
+		{
+			const auto capacity = std::bit_ceil(std::max(Config::pendingQueueCapacity, 2u));
+
+			new (sharedHeader) Header;
+
+			for (unsigned i = 0; i < capacity; ++i)
+				new (&sharedCells[i]) Cell;
+
+			initialize(sharedHeader, sharedCells, capacity);
+			this->segment->markReady();
+		}
+		else
+		{
+			header = sharedHeader;
+			cells = sharedCells;
+			mask = header->capacity - 1;
+
+			// Left by a previous run of this instance, if it died while parked.
+			header->sleepers[Config::instanceId].store(0, std::memory_order_relaxed);
+		}
+
+		header->heartbeats[Config::instanceId].store(getSteadyNanos(), std::memory_order_relaxed);
+	}
+
+	PendingPaymentsQueue::~PendingPaymentsQueue() = default;
+
+	std::shared_ptr<PendingPaymentsQueue> PendingPaymentsQueue::create()
+	{
+		if (!Config::sharedPendingQueue)
+			return std::make_shared<PendingPaymentsQueue>();
+
+		return std::make_shared<PendingPaymentsQueue>(std::make_unique<SharedMemorySegment>(
+			SHARED_QUEUE_NAME, getSharedSize(Config::pendingQueueCapacity), Config::databaseInit));
+	}
+
+	void PendingPaymentsQueue::initialize(Header* newHeader, Cell* newCells, unsigned capacity)
+	{
+		header = newHeader;
+		cells = newCells;
+
+		header->capacity = std::bit_ceil(std::max(capacity, 2u));
+		mask = header->capacity - 1;
+
+		for (std::uint64_t i = 0; i < header->capacity; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	void PendingPaymentsQueue::recoverAbandoned()
+	{
+		if (!shared)
+			return;
+
+		const auto now = getSteadyNanos();
+		header->heartbeats[Config::instanceId].store(now, std::memory_order_relaxed);
+
+		const auto dequeuePos = header->dequeuePos.load(std::memory_order_acquire);
+		const auto enqueuePos = header->enqueuePos.load(std::memory_order_acquire);
+
+		// Consumers stop at a claimed cell whose producer never published it.
+		if (dequeuePos < enqueuePos &&
+			cells[dequeuePos & mask].sequence.load(std::memory_order_acquire) == dequeuePos)
+		{
+			if (const auto stall = trackStall(unpublishedStall, dequeuePos, enqueuePos, now))
+			{
+				if (const auto count = skipUnpublished(*stall))
+					std::println(stderr, "Skipped {} pending queue cells abandoned by their producer.", count);
+			}
+		}
+		else
+			unpublishedStall.reset();
+
+		// Producers find the ring full at a consumed cell whose consumer never released it.
+		if (enqueuePos >= header->capacity && dequeuePos > enqueuePos - header->capacity &&
+			cells[enqueuePos & mask].sequence.load(std::memory_order_acquire) == enqueuePos - header->capacity + 1)
+		{
+			if (const auto stall = trackStall(unreleasedStall, enqueuePos, dequeuePos, now))
+			{
+				if (const auto count = releaseUnreleased(*stall))
+					std::println(stderr, "Released {} pending queue cells, their payments were lost.", count);
+			}
+		}
+		else
+			unreleasedStall.reset();
+	}
+
+	std::optional<PendingPaymentsQueue::Stall> PendingPaymentsQueue::trackStall(
+		std::optional<Stall>& stall, std::uint64_t position, std::uint64_t limit, std::int64_t now)
+	{
+		if (!stall || stall->position != position)
+		{
+			stall = Stall{.position = position, .limit = limit, .since = now};
+			return std::nullopt;
+		}
+
+		if (now - stall->since < std::chrono::nanoseconds(STALL_TIMEOUT).count())
+			return std::nullopt;
+
+		const auto result = *stall;
+		stall.reset();
+
+		return result;
+	}
+
+	unsigned PendingPaymentsQueue::skipUnpublished(const Stall& stall)
+	{
+		unsigned count = 0;
+
+		// Cells claimed before the stall was seen and still unpublished belong to dead producers.
+		for (auto pos = stall.position; pos < stall.limit; ++pos)
+		{
+			auto& cell = cells[pos & mask];
+			auto expected = pos;
+
+			// Claims the cell against the other instance's recovery. Consumers and producers of the next lap keep
+			// away from it meanwhile.
+			if (cell.sequence.compare_exchange_strong(
+					expected, pos + 2 * header->capacity, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				cell.payment.enqueuedAt = ABANDONED;
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				++count;
+			}
+		}
+
+		return count;
+	}
+
+	unsigned PendingPaymentsQueue::releaseUnreleased(const Stall& stall)
+	{
+		unsigned count = 0;
+
+		// Cells consumed before the stall was seen and still unreleased belong to dead consumers.
+		for (auto pos = stall.position - header->capacity; pos < stall.limit; ++pos)
+		{
+			auto expected = pos + 1;
+
+			if (cells[pos & mask].sequence.compare_exchange_strong(
+					expected, pos + header->capacity, std::memory_order_release, std::memory_order_relaxed))
+			{
+				++count;
+			}
+		}
+
+		return count;
+	}
+}  // namespace rinhaback::api
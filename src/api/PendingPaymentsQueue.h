@@ -1,17 +1,33 @@
 #pragma once
 
+#include "./Config.h"
+#include "./Database.h"
+#include "./Futex.h"
+#include "./Metrics.h"
 #include "./SignalHandling.h"
+#include "./Tracing.h"
+#include "./Util.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <chrono>
-#include <condition_variable>
-#include <mutex>
+#include <memory>
 #include <optional>
-#include <queue>
+#include <span>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 
 
 namespace rinhaback::api
 {
+	class SharedMemorySegment;
+
+	// Bounded lock-free MPMC ring buffer (Vyukov's algorithm).
+	// Consumers spin for a while and then park in a futex, which producers only touch when there are sleepers.
+	// The ring may live in a shared memory segment, being then consumed by the processors of all instances.
+	// An instance dying between claiming a cell and publishing or releasing it would stall the other at that cell,
+	// so recoverAbandoned() skips or releases cells stuck for longer than STALL_TIMEOUT.
 	class PendingPaymentsQueue final
 	{
 	public:
@@ -19,57 +35,288 @@ namespace rinhaback::api
 		{
 			double amount;
 			CorrelationId correlationId;
+			std::uint32_t attempt = 0;
+			std::int64_t enqueuedAt = 0;  // steady clock nanoseconds, set by enqueue
+		};
+
+		static inline constexpr unsigned MAX_INSTANCES = 2;  // SharedData::MAX_INSTANCES
+
+	private:
+		struct alignas(64) Cell
+		{
+			std::atomic_uint64_t sequence;
+			Payment payment;
+		};
+
+		struct alignas(64) Header
+		{
+			std::uint64_t capacity;
+			alignas(64) std::atomic_uint64_t enqueuePos{0};
+			alignas(64) std::atomic_uint64_t dequeuePos{0};
+			alignas(64) std::atomic_uint32_t wakeEpoch{0};
+			std::atomic_uint32_t sleepers[MAX_INSTANCES]{};
+			std::atomic_int64_t heartbeats[MAX_INSTANCES]{};  // steady clock nanoseconds, see recoverAbandoned
+			std::atomic_uint64_t rejectedCount{0};
+		};
+
+		// A position the queue was found stuck at, since a steady clock nanoseconds time.
+		struct Stall
+		{
+			std::uint64_t position;
+			std::uint64_t limit;  // cells before it were claimed before the stall was seen
+			std::int64_t since;
 		};
 
 	public:
-		PendingPaymentsQueue() = default;
+		// Creates a queue private to this process.
+		explicit PendingPaymentsQueue(unsigned capacity = Config::pendingQueueCapacity);
+
+		// Creates (DATABASE_INIT instance) or opens the queue shared by all instances.
+		explicit PendingPaymentsQueue(std::unique_ptr<SharedMemorySegment> segment);
+
+		~PendingPaymentsQueue();
 
 		PendingPaymentsQueue(const PendingPaymentsQueue&) = delete;
 		PendingPaymentsQueue& operator=(const PendingPaymentsQueue&) = delete;
 
 	public:
-		void enqueue(const Payment& payment)
+		// Creates a shared or private queue according to SHARED_PENDING_QUEUE.
+		static std::shared_ptr<PendingPaymentsQueue> create();
+
+	public:
+		// Never blocks. Returns false when the queue is full.
+		bool enqueue(const Payment& payment)
 		{
-			{  // scope
-				std::unique_lock lock(mutex);
-				queue.push(payment);
-			}
+			auto pos = header->enqueuePos.load(std::memory_order_relaxed);
+			Cell* cell;
+
+			do
+			{
+				cell = &cells[pos & mask];
+				const auto sequence = cell->sequence.load(std::memory_order_acquire);
+				const auto diff = static_cast<std::int64_t>(sequence - pos);
+
+				if (diff == 0)
+				{
+					if (header->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					header->rejectedCount.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				else
+					pos = header->enqueuePos.load(std::memory_order_relaxed);
+			} while (true);
 
-			condVar.notify_one();
+			cell->payment = payment;
+			cell->payment.enqueuedAt = getSteadyNanos();
+			cell->sequence.store(pos + 1, std::memory_order_release);
+
+			wakeConsumer();
+
+			return true;
 		}
 
-		std::optional<Payment> dequeue()
+		std::optional<Payment> tryDequeue()
 		{
+			Payment payment;
+
+			if (tryDequeueBulk(std::span(&payment, 1)) == 0)
+				return std::nullopt;
+
+			return payment;
+		}
+
+		// Takes up to payments.size() contiguous payments with a single CAS.
+		std::size_t tryDequeueBulk(std::span<Payment> payments)
+		{
+			auto pos = header->dequeuePos.load(std::memory_order_relaxed);
+			std::size_t count;
+
 			do
 			{
-				std::unique_lock lock(mutex);
+				count = 0;
+
+				while (count < payments.size() &&
+					cells[(pos + count) & mask].sequence.load(std::memory_order_acquire) == pos + count + 1)
+				{
+					++count;
+				}
 
-				if (!condVar.wait_for(lock, SignalHandling::WAIT_TIME, [&] { return !queue.empty(); }))
+				if (count == 0)
 				{
-					if (SignalHandling::shouldFinish())
-						return std::nullopt;
+					const auto newPos = header->dequeuePos.load(std::memory_order_relaxed);
+
+					if (newPos == pos)
+						return 0;
 
+					pos = newPos;
+				}
+				else if (header->dequeuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+					break;
+			} while (true);
+
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				auto& cell = cells[(pos + i) & mask];
+				payments[i] = cell.payment;
+				cell.sequence.store(pos + i + header->capacity, std::memory_order_release);
+			}
+
+			const auto now = getSteadyNanos();
+			std::size_t kept = 0;
+
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				if (payments[i].enqueuedAt == ABANDONED)
 					continue;
+
+				Metrics::record(Metrics::Histogram::QUEUE_WAIT, std::chrono::nanoseconds(now - payments[i].enqueuedAt));
+				Tracing::record(Tracing::Stage::QUEUE_WAIT, payments[i].correlationId, payments[i].enqueuedAt, now);
+
+				payments[kept++] = payments[i];
+			}
+
+			// Only cells skipped by recoverAbandoned were taken, there may be payments after them.
+			if (kept == 0)
+				return tryDequeueBulk(payments);
+
+			return kept;
+		}
+
+		// Blocks until a payment is available or the application is finishing.
+		std::optional<Payment> dequeue()
+		{
+			Payment payment;
+
+			if (dequeueBulk(std::span(&payment, 1)) == 0)
+				return std::nullopt;
+
+			return payment;
+		}
+
+		// Blocks until at least one payment is available or the application is finishing.
+		std::size_t dequeueBulk(std::span<Payment> payments)
+		{
+			do
+			{
+				for (unsigned spin = 0; spin < SPIN_COUNT; ++spin)
+				{
+					if (const auto count = tryDequeueBulk(payments))
+						return count;
+
+					__builtin_ia32_pause();
 				}
 
-				assert(!queue.empty());
+				const auto epoch = header->wakeEpoch.load(std::memory_order_acquire);
+				auto& sleepers = header->sleepers[Config::instanceId];
+				sleepers.fetch_add(1, std::memory_order_seq_cst);
 
-				Payment payment = queue.front();
-				queue.pop();
+				if (const auto count = tryDequeueBulk(payments))
+				{
+					sleepers.fetch_sub(1, std::memory_order_relaxed);
+					return count;
+				}
 
-				return payment;
+				Futex::wait(header->wakeEpoch, epoch, SignalHandling::WAIT_TIME, shared);
+				sleepers.fetch_sub(1, std::memory_order_relaxed);
+
+				if (SignalHandling::shouldFinish())
+					return 0;
 			} while (true);
 		}
 
 		void purge()
 		{
-			std::unique_lock lock(mutex);
-			queue = {};
+			Payment payments[64];
+
+			while (tryDequeueBulk(payments) != 0)
+				;
 		}
 
+		std::size_t getDepth() const
+		{
+			const auto dequeued = header->dequeuePos.load(std::memory_order_relaxed);
+			const auto enqueued = header->enqueuePos.load(std::memory_order_relaxed);
+
+			return enqueued > dequeued ? static_cast<std::size_t>(enqueued - dequeued) : 0;
+		}
+
+		std::size_t getCapacity() const
+		{
+			return header->capacity;
+		}
+
+		// Number of payments refused because the queue was full.
+		std::uint64_t getRejectedCount() const
+		{
+			return header->rejectedCount.load(std::memory_order_relaxed);
+		}
+
+		// Publishes the heartbeat of this instance and repairs the cells abandoned by a dead one. Must be called
+		// periodically (well within STALL_TIMEOUT) by a single thread of every instance sharing the queue.
+		void recoverAbandoned();
+
+	private:
+		void wakeConsumer()
+		{
+			// Pairs with the seq_cst increment of sleepers in dequeueBulk.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			for (unsigned i = 0; i < MAX_INSTANCES; ++i)
+			{
+				// A dead instance leaves its sleepers counted, which must not cost a syscall per payment.
+				if (header->sleepers[i].load(std::memory_order_relaxed) != 0 && isAlive(i))
+				{
+					header->wakeEpoch.fetch_add(1, std::memory_order_release);
+					Futex::wake(header->wakeEpoch, 1, shared);
+					break;
+				}
+			}
+		}
+
+		bool isAlive(unsigned instance) const
+		{
+			return !shared ||
+				getSteadyNanos() - header->heartbeats[instance].load(std::memory_order_relaxed) <
+				std::chrono::nanoseconds(STALL_TIMEOUT).count();
+		}
+
+	private:
+		static inline constexpr unsigned SPIN_COUNT = 256;
+
+		// Longer than any live thread takes between claiming a cell and publishing or releasing it.
+		static inline constexpr std::chrono::seconds STALL_TIMEOUT{1};
+
+		// enqueuedAt of the cells skipped by recoverAbandoned.
+		static inline constexpr std::int64_t ABANDONED = -1;
+
+	private:
+		static std::size_t getSharedSize(unsigned capacity)
+		{
+			return sizeof(Header) + sizeof(Cell) * std::bit_ceil(std::max(capacity, 2u));
+		}
+
+		void initialize(Header* newHeader, Cell* newCells, unsigned capacity);
+
+		// Returns the stall once it lasted STALL_TIMEOUT at the same position.
+		static std::optional<Stall> trackStall(
+			std::optional<Stall>& stall, std::uint64_t position, std::uint64_t limit, std::int64_t now);
+
+		unsigned skipUnpublished(const Stall& stall);
+		unsigned releaseUnreleased(const Stall& stall);
+
 	private:
-		std::mutex mutex;
-		std::condition_variable condVar;
-		std::queue<Payment> queue;
+		std::unique_ptr<SharedMemorySegment> segment;
+		std::unique_ptr<Header> ownedHeader;
+		std::unique_ptr<Cell[]> ownedCells;
+		Header* header;
+		Cell* cells;
+		std::uint64_t mask;
+		bool shared;
+		std::optional<Stall> unpublishedStall;
+		std::optional<Stall> unreleasedStall;
 	};
 }  // namespace rinhaback::api
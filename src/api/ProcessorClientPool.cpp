@@ -0,0 +1,75 @@
+#include "./ProcessorClientPool.h"
+#include "./Config.h"
+#include <algorithm>
+#include <cassert>
+
+
+namespace rinhaback::api
+{
+	ProcessorClientPool& ProcessorClientPool::get(PaymentGateway gateway)
+	{
+		static ProcessorClientPool defaultPool{Config::processorDefaultUrl, Config::processorPoolSize};
+		static ProcessorClientPool fallbackPool{Config::processorFallbackUrl, Config::processorPoolSize};
+
+		switch (gateway)
+		{
+			case PaymentGateway::DEFAULT:
+				return defaultPool;
+
+			case PaymentGateway::FALLBACK:
+				return fallbackPool;
+
+			default:
+				assert(false);
+				return defaultPool;
+		}
+	}
+
+	ProcessorClientPool::Lease ProcessorClientPool::acquire()
+	{
+		std::unique_lock lock(mutex);
+
+		condVar.wait(lock, [&] { return !idleClients.empty() || createdClients < size; });
+
+		if (idleClients.empty())
+		{
+			++createdClients;
+			lock.unlock();
+
+			return Lease(*this, PooledClient{.client = createClient(), .lastUsed = {}});
+		}
+
+		// Most recently used first, as it's the most likely to still have a live connection.
+		auto pooledClient = std::move(idleClients.back());
+		idleClients.pop_back();
+		lock.unlock();
+
+		// Don't rely on a connection the processor (or something in between) may have silently dropped.
+		if (std::chrono::steady_clock::now() - pooledClient.lastUsed > Config::processorPoolIdleTimeout)
+			pooledClient.client->stop();
+
+		return Lease(*this, std::move(pooledClient));
+	}
+
+	std::unique_ptr<httplib::Client> ProcessorClientPool::createClient() const
+	{
+		auto client = std::make_unique<httplib::Client>(url);
+		client->set_keep_alive(true);
+		return client;
+	}
+
+	void ProcessorClientPool::release(PooledClient pooledClient, bool broken)
+	{
+		if (broken)
+			pooledClient.client->stop();
+
+		pooledClient.lastUsed = std::chrono::steady_clock::now();
+
+		{  // scope
+			std::unique_lock lock(mutex);
+			idleClients.push_back(std::move(pooledClient));
+		}
+
+		condVar.notify_one();
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "./Database.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "httplib.h"
+
+
+namespace rinhaback::api
+{
+	// Keep-alive HTTP clients to a payment processor, shared by the processor threads.
+	class ProcessorClientPool final
+	{
+	private:
+		struct PooledClient
+		{
+			std::unique_ptr<httplib::Client> client;
+			std::chrono::steady_clock::time_point lastUsed;
+		};
+
+	public:
+		// Exclusive use of a pooled client, given back to the pool when destroyed.
+		class Lease final
+		{
+		public:
+			Lease(ProcessorClientPool& pool, PooledClient pooledClient)
+				: pool(pool),
+				  pooledClient(std::move(pooledClient))
+			{
+			}
+
+			~Lease()
+			{
+				pool.release(std::move(pooledClient), broken);
+			}
+
+			Lease(const Lease&) = delete;
+			Lease& operator=(const Lease&) = delete;
+
+		public:
+			httplib::Client* operator->()
+			{
+				return pooledClient.client.get();
+			}
+
+			// The connection failed, so it must be reopened on the next use.
+			void markBroken()
+			{
+				broken = true;
+			}
+
+		private:
+			ProcessorClientPool& pool;
+			PooledClient pooledClient;
+			bool broken = false;
+		};
+
+	public:
+		ProcessorClientPool(std::string url, unsigned size)
+			: url(std::move(url)),
+			  size(size)
+		{
+		}
+
+		ProcessorClientPool(const ProcessorClientPool&) = delete;
+		ProcessorClientPool& operator=(const ProcessorClientPool&) = delete;
+
+	public:
+		static ProcessorClientPool& get(PaymentGateway gateway);
+
+		// Waits for a free client when all of them are in use.
+		Lease acquire();
+
+	private:
+		std::unique_ptr<httplib::Client> createClient() const;
+		void release(PooledClient pooledClient, bool broken);
+
+	private:
+		const std::string url;
+		const unsigned size;
+		std::mutex mutex;
+		std::condition_variable condVar;
+		std::vector<PooledClient> idleClients;
+		unsigned createdClients = 0;
+	};
+}  // namespace rinhaback::api
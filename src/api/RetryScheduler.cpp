@@ -0,0 +1,112 @@
+#include "./RetryScheduler.h"
+#include "./Config.h"
+#include "./Metrics.h"
+#include "./Tracing.h"
+#include <algorithm>
+#include <print>
+#include <random>
+
+
+namespace rinhaback::api
+{
+	std::jthread RetryScheduler::start(std::shared_ptr<RetryScheduler> retryScheduler)
+	{
+		return std::jthread([retryScheduler](std::stop_token stopToken)
+			{ retryScheduler->handler(std::move(stopToken)); });
+	}
+
+	void RetryScheduler::schedule(PendingPaymentsQueue::Payment payment)
+	{
+		Metrics::increment(Metrics::Counter::PAYMENTS_RETRIED);
+
+		const auto now = std::chrono::steady_clock::now();
+		const auto dueAt = now + getBackoff(payment.attempt);
+		++payment.attempt;
+
+		Tracing::record(Tracing::Stage::RETRY_BACKOFF, payment.correlationId, toSteadyNanos(now), toSteadyNanos(dueAt));
+
+		bool notify;
+
+		{  // scope
+			std::unique_lock lock(mutex);
+
+			notify = scheduledPayments.empty() || dueAt < scheduledPayments.top().dueAt;
+			scheduledPayments.push(ScheduledPayment{.dueAt = dueAt, .payment = payment});
+		}
+
+		if (notify)
+			condVar.notify_one();
+	}
+
+	void RetryScheduler::purge()
+	{
+		std::unique_lock lock(mutex);
+		scheduledPayments = {};
+	}
+
+	// Equal jitter: half of the exponential delay plus a random part of the other half.
+	std::chrono::microseconds RetryScheduler::getBackoff(unsigned attempt)
+	{
+		thread_local std::minstd_rand random{std::random_device{}()};
+
+		const auto maxDelay = std::chrono::duration_cast<std::chrono::microseconds>(Config::retryMaxDelay);
+		const auto exponentialDelay =
+			std::min(std::chrono::duration_cast<std::chrono::microseconds>(Config::retryBaseDelay) *
+					(1LL << std::min(attempt, 20u)),
+				maxDelay);
+		const auto half = exponentialDelay.count() / 2;
+
+		return std::chrono::microseconds(
+			half + std::uniform_int_distribution<std::chrono::microseconds::rep>(0, half)(random));
+	}
+
+	void RetryScheduler::handler(std::stop_token stopToken)
+	{
+		std::println("RetryScheduler started.");
+
+		std::vector<PendingPaymentsQueue::Payment> duePayments;
+		std::unique_lock lock(mutex);
+
+		while (!stopToken.stop_requested())
+		{
+			if (scheduledPayments.empty())
+			{
+				condVar.wait(lock, stopToken, [&] { return !scheduledPayments.empty(); });
+				continue;
+			}
+
+			const auto now = std::chrono::steady_clock::now();
+
+			if (const auto dueAt = scheduledPayments.top().dueAt; dueAt > now)
+			{
+				condVar.wait_until(lock, stopToken, dueAt,
+					[&] { return scheduledPayments.empty() || scheduledPayments.top().dueAt < dueAt; });
+				continue;
+			}
+
+			while (!scheduledPayments.empty() && scheduledPayments.top().dueAt <= now)
+			{
+				duePayments.push_back(scheduledPayments.top().payment);
+				scheduledPayments.pop();
+			}
+
+			lock.unlock();
+
+			for (const auto& payment : duePayments)
+			{
+				// Queue is full, try again later.
+				if (!pendingPaymentsQueue->enqueue(payment))
+				{
+					lock.lock();
+					scheduledPayments.push(ScheduledPayment{.dueAt = now + Config::retryMaxDelay, .payment = payment});
+					lock.unlock();
+				}
+			}
+
+			duePayments.clear();
+			lock.lock();
+		}
+
+		std::println("RetryScheduler stopped.");
+	}
+}  // namespace rinhaback::api
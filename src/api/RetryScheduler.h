@@ -0,0 +1,59 @@
+#pragma once
+
+#include "./PendingPaymentsQueue.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+
+namespace rinhaback::api
+{
+	// Delays failed payments with jittered exponential backoff and puts them back in the pending queue when due,
+	// so processors don't spin on a failing processor while other payments wait.
+	class RetryScheduler final
+	{
+	private:
+		struct ScheduledPayment
+		{
+			std::chrono::steady_clock::time_point dueAt;
+			PendingPaymentsQueue::Payment payment;
+
+			bool operator>(const ScheduledPayment& other) const
+			{
+				return dueAt > other.dueAt;
+			}
+		};
+
+	public:
+		explicit RetryScheduler(std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue)
+			: pendingPaymentsQueue(std::move(pendingPaymentsQueue))
+		{
+		}
+
+		RetryScheduler(const RetryScheduler&) = delete;
+		RetryScheduler& operator=(const RetryScheduler&) = delete;
+
+	public:
+		static std::jthread start(std::shared_ptr<RetryScheduler> retryScheduler);
+
+		void schedule(PendingPaymentsQueue::Payment payment);
+		void purge();
+
+	private:
+		static std::chrono::microseconds getBackoff(unsigned attempt);
+
+		void handler(std::stop_token stopToken);
+
+	private:
+		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
+		std::mutex mutex;
+		std::condition_variable_any condVar;
+		std::priority_queue<ScheduledPayment, std::vector<ScheduledPayment>, std::greater<>> scheduledPayments;
+	};
+}  // namespace rinhaback::api
@@ -0,0 +1,147 @@
+#include "./SharedMemory.h"
+#include "./Config.h"
+#include <chrono>
+#include <format>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+
+namespace rinhaback::api
+{
+	namespace boostipc = boost::interprocess;
+
+	namespace
+	{
+		class SharedMemoryManager
+		{
+		private:
+			static inline constexpr const char* SHARED_MEMORY_NAME = "SharedData";
+
+		public:
+			SharedMemoryManager(bool isCreator = false)
+				: segment(SHARED_MEMORY_NAME, getSize(isCreator), isCreator)
+			{
+				if (Config::instanceId >= SharedData::MAX_INSTANCES)
+				{
+					throw std::runtime_error(std::format(
+						"Invalid INSTANCE_ID: {} (maximum: {})", Config::instanceId, SharedData::MAX_INSTANCES - 1));
+				}
+
+				if (isCreator)
+				{
+					data = new (segment.getAddress()) SharedData;
+					data->metricsShardsPerInstance = Metrics::getShardCount();
+
+					for (unsigned i = 0; i < SharedData::MAX_INSTANCES; ++i)
+					{
+						for (auto& shard : data->getMetricsShards(i))
+							new (&shard) SharedData::MetricsShard;
+					}
+
+					segment.markReady();
+				}
+				else
+					data = static_cast<SharedData*>(segment.getAddress());
+
+				auto& instance = data->instances[Config::instanceId];
+
+				// Batches a previous run of this instance acknowledged but never committed are lost, so they must
+				// not hold the summaries of the other instance back.
+				instance.committedPayments.store(instance.acknowledgedPayments.load());
+				instance.commitWaiters.store(0, std::memory_order_relaxed);
+				instance.heartbeat.store(getSteadyNanos(), std::memory_order_relaxed);
+			}
+
+		private:
+			// Others open it by the size of what they read before the shards.
+			static std::size_t getSize(bool isCreator)
+			{
+				const auto shards = isCreator ? SharedData::MAX_INSTANCES * Metrics::getShardCount() : 0;
+				return sizeof(SharedData) + sizeof(SharedData::MetricsShard) * shards;
+			}
+
+		public:
+			SharedData* data;
+
+		private:
+			SharedMemorySegment segment;
+		};
+	}  // namespace
+
+	SharedMemorySegment::SharedMemorySegment(const char* baseName, std::size_t size, bool isCreator)
+	{
+		const auto nameString = getName(baseName);
+		const auto name = nameString.c_str();
+
+		if (isCreator)
+		{
+			// A process still attached to the segment of a previous run must not take it for the new one.
+			try
+			{
+				shm = boostipc::shared_memory_object(boostipc::open_only, name, boostipc::read_write);
+				region = boostipc::mapped_region(shm, boostipc::read_write);
+				getPrefix()->readyWord.store(0, std::memory_order_release);
+			}
+			catch (const boostipc::interprocess_exception&)
+			{
+				// There was none.
+			}
+
+			boostipc::shared_memory_object::remove(name);
+			shm = boostipc::shared_memory_object(boostipc::create_only, name, boostipc::read_write);
+
+			shm.truncate(PREFIX_SIZE + size);
+
+			region = boostipc::mapped_region(shm, boostipc::read_write);
+		}
+		else
+		{
+			const auto deadline = std::chrono::steady_clock::now() + OPEN_TIMEOUT;
+
+			while (true)
+			{
+				try
+				{
+					boostipc::offset_t shmSize = 0;
+					shm = boostipc::shared_memory_object(boostipc::open_only, name, boostipc::read_write);
+
+					// The creator may not have sized it yet.
+					if (shm.get_size(shmSize) && static_cast<std::size_t>(shmSize) >= PREFIX_SIZE + size)
+					{
+						region = boostipc::mapped_region(shm, boostipc::read_write);
+
+						if (isReady())
+							break;
+					}
+				}
+				catch (const boostipc::interprocess_exception&)
+				{
+					// Not created yet.
+				}
+
+				if (std::chrono::steady_clock::now() >= deadline)
+					throw std::runtime_error(std::format("Shared memory segment {} was not made ready.", name));
+
+				std::this_thread::sleep_for(OPEN_RETRY_DELAY);
+			}
+		}
+	}
+
+	std::string SharedMemorySegment::getName(const char* baseName)
+	{
+		return std::format("{}-{}", Config::sharedMemoryPrefix, baseName);
+	}
+
+	void SharedMemorySegment::remove(const char* baseName)
+	{
+		boostipc::shared_memory_object::remove(getName(baseName).c_str());
+	}
+
+	SharedData& getSharedData()
+	{
+		static SharedMemoryManager sharedMemoryManager{Config::databaseInit};
+		return *sharedMemoryManager.data;
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "./Database.h"
+#include "./LogLinearBuckets.h"
+#include "./Metrics.h"
+#include "./Util.h"
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <string>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "boost/interprocess/shared_memory_object.hpp"
+#include "boost/interprocess/mapped_region.hpp"
+
+
+namespace rinhaback::api
+{
+	// Data shared by all the API instances. The metrics shards of the instances follow it in the segment.
+	struct alignas(64) SharedData
+	{
+		static inline constexpr unsigned MAX_INSTANCES = 2;
+
+		// Each thread records its metrics in its own shard.
+		struct alignas(64) MetricsShard
+		{
+			struct Histogram
+			{
+				std::atomic_uint64_t count{0};
+				std::atomic_uint64_t sumMicros{0};
+				std::atomic_uint64_t buckets[Metrics::HISTOGRAM_BUCKETS]{};
+			};
+
+			std::atomic_uint64_t counters[std::to_underlying(Metrics::Counter::SIZE)]{};
+			Histogram histograms[std::to_underlying(Metrics::Histogram::SIZE)];
+		};
+
+		struct InstanceData
+		{
+			// Longer than the main loop of a live instance takes between heartbeats.
+			static inline constexpr std::chrono::seconds HEARTBEAT_TIMEOUT{1};
+
+			std::atomic_uint64_t acknowledgedPayments{0};
+			std::atomic_uint64_t committedPayments{0};
+			std::atomic_uint32_t commitEpoch{0};  // futex bumped when committedPayments grows
+			std::atomic_uint32_t commitWaiters{0};
+			std::atomic_int64_t heartbeat{0};  // steady clock nanoseconds, published by the main loop
+			std::atomic_int64_t gauges[std::to_underlying(Metrics::Gauge::SIZE)]{};
+
+			bool isAlive() const
+			{
+				return getSteadyNanos() - heartbeat.load(std::memory_order_relaxed) <
+					std::chrono::nanoseconds(HEARTBEAT_TIMEOUT).count();
+			}
+		};
+
+		// Outcomes of the payments sent to a gateway. See GatewayStats.
+		struct GatewayStatsData
+		{
+			// Latency microseconds, two buckets per power of two up to 2^32us.
+			using HistogramBuckets = LogLinearBuckets<1, 32>;
+			static inline constexpr unsigned HISTOGRAM_BUCKETS = HistogramBuckets::COUNT;
+
+			std::atomic<double> latencyMicros{0};
+			std::atomic<double> errorRate{0};
+			std::atomic_int64_t lastSampleAt{0};
+			std::atomic_uint32_t latencyHistogram[HISTOGRAM_BUCKETS]{};
+		};
+
+		// See CircuitBreaker.
+		struct CircuitBreakerData
+		{
+			// Steady clock nanoseconds of the last transition << 2 | state, so both change atomically.
+			std::atomic_uint64_t stateWord{0};
+			std::atomic_uint32_t consecutiveFailures{0};
+			std::atomic_uint32_t probesInFlight{0};
+			std::atomic_uint32_t probeSuccesses{0};
+		};
+
+		std::atomic_uint8_t currentGateway{static_cast<std::uint8_t>(PaymentGateway::DEFAULT)};
+		InstanceData instances[MAX_INSTANCES];
+
+		GatewayStatsData gatewayStats[std::to_underlying(PaymentGateway::SIZE)];
+		std::atomic_int64_t lastStatsDecayAt{0};
+		std::atomic_int64_t lastGatewayEvaluationAt{0};
+
+		CircuitBreakerData circuitBreakers[std::to_underlying(PaymentGateway::SIZE)];
+
+		// Health polling lease: steady clock milliseconds of its expiration << 8 | (holder instanceId + 1).
+		std::atomic_uint64_t healthLease{0};
+		std::atomic_int64_t lastHealthPollAt{0};
+
+		// Set by the creator from its configuration (see Metrics::getShardCount).
+		std::uint32_t metricsShardsPerInstance = 0;
+
+		std::span<MetricsShard> getMetricsShards(unsigned instance)
+		{
+			return std::span(reinterpret_cast<MetricsShard*>(this + 1) + instance * metricsShardsPerInstance,
+				metricsShardsPerInstance);
+		}
+
+		std::span<const MetricsShard> getMetricsShards(unsigned instance) const
+		{
+			return const_cast<SharedData*>(this)->getMetricsShards(instance);
+		}
+	};
+
+	// A named shared memory segment, named SHARED_MEMORY_PREFIX-baseName. The creator (re)creates it zero filled
+	// and calls markReady() once its contents are initialized. The others wait for that to open it.
+	class SharedMemorySegment final
+	{
+	private:
+		struct Prefix
+		{
+			std::atomic_uint64_t readyWord;
+		};
+
+	public:
+		SharedMemorySegment(const char* baseName, std::size_t size, bool isCreator);
+
+		SharedMemorySegment(const SharedMemorySegment&) = delete;
+		SharedMemorySegment& operator=(const SharedMemorySegment&) = delete;
+
+	public:
+		static void remove(const char* baseName);
+
+	public:
+		void* getAddress() const
+		{
+			return static_cast<std::byte*>(region.get_address()) + PREFIX_SIZE;
+		}
+
+		void markReady()
+		{
+			getPrefix()->readyWord.store(READY_MAGIC, std::memory_order_release);
+		}
+
+	private:
+		static std::string getName(const char* baseName);
+
+		Prefix* getPrefix() const
+		{
+			return static_cast<Prefix*>(region.get_address());
+		}
+
+		bool isReady() const
+		{
+			return getPrefix()->readyWord.load(std::memory_order_acquire) == READY_MAGIC;
+		}
+
+	private:
+		static inline constexpr std::uint64_t READY_MAGIC = 0x5259'4441'4552'0001;
+		static inline constexpr std::size_t PREFIX_SIZE = 64;  // keeps the contents cache line aligned
+		static inline constexpr std::chrono::milliseconds OPEN_RETRY_DELAY{10};
+		static inline constexpr std::chrono::seconds OPEN_TIMEOUT{30};
+
+	private:
+		boost::interprocess::shared_memory_object shm;
+		boost::interprocess::mapped_region region;
+	};
+
+	SharedData& getSharedData();
+}  // namespace rinhaback::api
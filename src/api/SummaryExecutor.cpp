@@ -0,0 +1,83 @@
+#include "./SummaryExecutor.h"
+#include <array>
+#include <exception>
+#include <format>
+#include <print>
+
+
+namespace rinhaback::api
+{
+	std::jthread SummaryExecutor::start(std::shared_ptr<SummaryExecutor> summaryExecutor)
+	{
+		return std::jthread([summaryExecutor](std::stop_token stopToken)
+			{ summaryExecutor->handler(std::move(stopToken)); });
+	}
+
+	std::size_t SummaryExecutor::formatSummary(
+		std::span<char> buffer, const PaymentService::PaymentsSummaryResponse& summary)
+	{
+		const auto& defaultGateway = summary.defaultGateway;
+		const auto& fallbackGateway = summary.fallbackGateway;
+
+		// Amounts are never negative.
+		const auto formatResult = std::format_to_n(buffer.begin(), buffer.size() - 1,
+			R"({{"default":{{"totalRequests":{},"totalAmount":{}.{:02}}},)"
+			R"("fallback":{{"totalRequests":{},"totalAmount":{}.{:02}}}}})",
+			defaultGateway.totalRequests, defaultGateway.totalAmountCents / 100, defaultGateway.totalAmountCents % 100,
+			fallbackGateway.totalRequests, fallbackGateway.totalAmountCents / 100,
+			fallbackGateway.totalAmountCents % 100);
+
+		*formatResult.out = '\0';
+
+		return static_cast<std::size_t>(formatResult.out - buffer.begin());
+	}
+
+	void SummaryExecutor::submit(
+		mg_mgr* mgr, unsigned long connId, std::optional<DateTimeMillis> from, std::optional<DateTimeMillis> to)
+	{
+		{  // scope
+			std::unique_lock lock(mutex);
+			queries.push_back(Query{.mgr = mgr, .connId = connId, .from = from, .to = to});
+		}
+
+		condVar.notify_one();
+	}
+
+	void SummaryExecutor::handler(std::stop_token stopToken)
+	{
+		std::println("SummaryExecutor started.");
+
+		std::array<char, 2000> json;
+
+		while (true)
+		{
+			Query query;
+
+			{  // scope
+				std::unique_lock lock(mutex);
+
+				if (!condVar.wait(lock, stopToken, [&] { return !queries.empty(); }))
+					break;
+
+				query = queries.front();
+				queries.pop_front();
+			}
+
+			std::size_t jsonLength = 0;
+
+			try
+			{
+				jsonLength = formatSummary(json, paymentService->getPaymentsSummary(query.from, query.to));
+			}
+			catch (const std::exception& e)
+			{
+				std::println(stderr, "{}", e.what());
+			}
+
+			// An empty message tells the event loop the query failed.
+			mg_wakeup(query.mgr, query.connId, json.data(), jsonLength);
+		}
+
+		std::println("SummaryExecutor stopped.");
+	}
+}  // namespace rinhaback::api
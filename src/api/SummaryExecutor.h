@@ -0,0 +1,61 @@
+#pragma once
+
+#include "./PaymentService.h"
+#include "./Util.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include "mongoose.h"
+
+
+namespace rinhaback::api
+{
+	// Runs /payments-summary queries out of the mongoose event loops, so a long LMDB scan doesn't stall the other
+	// connections of the server thread. The formatted reply is sent back to the connection with mg_wakeup.
+	class SummaryExecutor final
+	{
+	private:
+		struct Query
+		{
+			mg_mgr* mgr;
+			unsigned long connId;
+			std::optional<DateTimeMillis> from;
+			std::optional<DateTimeMillis> to;
+		};
+
+	public:
+		explicit SummaryExecutor(std::shared_ptr<PaymentService> paymentService)
+			: paymentService(std::move(paymentService))
+		{
+		}
+
+		SummaryExecutor(const SummaryExecutor&) = delete;
+		SummaryExecutor& operator=(const SummaryExecutor&) = delete;
+
+	public:
+		static std::jthread start(std::shared_ptr<SummaryExecutor> summaryExecutor);
+
+		// Formats the summary JSON into the buffer and returns its length.
+		static std::size_t formatSummary(
+			std::span<char> buffer, const PaymentService::PaymentsSummaryResponse& summary);
+
+		// The manager must have been initialized with mg_wakeup_init. The reply arrives as a MG_EV_WAKEUP event
+		// with the JSON body, unless the connection was closed meanwhile.
+		void submit(mg_mgr* mgr, unsigned long connId, std::optional<DateTimeMillis> from,
+			std::optional<DateTimeMillis> to);
+
+	private:
+		void handler(std::stop_token stopToken);
+
+	private:
+		std::shared_ptr<PaymentService> paymentService;
+		std::mutex mutex;
+		std::condition_variable_any condVar;
+		std::deque<Query> queries;
+	};
+}  // namespace rinhaback::api
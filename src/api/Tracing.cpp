@@ -0,0 +1,157 @@
+#include "./Tracing.h"
+#include <algorithm>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+
+namespace rinhaback::api
+{
+	// Single producer ring. Readers copy it concurrently and discard what may have been overwritten meanwhile.
+	struct Tracing::Ring
+	{
+		explicit Ring(std::size_t capacity)
+			: events(std::max<std::size_t>(capacity, 1))
+		{
+		}
+
+		std::vector<Event> events;
+		std::atomic_uint64_t writeIndex{0};
+		unsigned threadId = static_cast<unsigned>(gettid());
+	};
+
+	namespace
+	{
+		struct Registry
+		{
+			std::mutex mutex;
+			// Rings outlive their threads, so their events can still be exported.
+			std::vector<std::shared_ptr<Tracing::Ring>> rings;
+		};
+	}  // namespace
+
+	static Registry& getRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	static constexpr std::string_view STAGE_NAMES[] = {
+		"receive",
+		"queue wait",
+		"upstream call",
+		"retry backoff",
+		"commit",
+	};
+
+	void Tracing::recordEvent(const Event& event)
+	{
+		thread_local Ring* ring = []
+		{
+			auto& registry = getRegistry();
+			const auto newRing = std::make_shared<Ring>(Config::tracingBufferSize);
+
+			std::unique_lock lock(registry.mutex);
+			registry.rings.push_back(newRing);
+
+			return newRing.get();
+		}();
+
+		const auto index = ring->writeIndex.load(std::memory_order_relaxed);
+		ring->events[index % ring->events.size()] = event;
+		ring->writeIndex.store(index + 1, std::memory_order_release);
+	}
+
+	Tracing::ChromeJsonWriter::ChromeJsonWriter()
+	{
+		auto& registry = getRegistry();
+		std::unique_lock lock(registry.mutex);
+		rings = registry.rings;
+	}
+
+	bool Tracing::ChromeJsonWriter::write(std::string& out, std::size_t maxEvents)
+	{
+		if (!started)
+		{
+			out += R"({"displayTimeUnit":"ms","traceEvents":[)";
+			started = true;
+		}
+
+		std::size_t written = 0;
+
+		while (ringIndex < rings.size() && written < maxEvents)
+		{
+			const auto& ring = *rings[ringIndex];
+			const auto capacity = ring.events.size();
+
+			if (!ringStarted)
+			{
+				endIndex = ring.writeIndex.load(std::memory_order_acquire);
+				nextIndex = endIndex > capacity ? endIndex - capacity : 0;
+				ringStarted = true;
+			}
+
+			const auto count = std::min<std::uint64_t>(endIndex - nextIndex, maxEvents - written);
+
+			events.clear();
+
+			for (auto index = nextIndex; index < nextIndex + count; ++index)
+				events.push_back(ring.events[index % capacity]);
+
+			// While they were copied, the producer may have overwritten the oldest events, and may be writing the slot
+			// of index newEndIndex - capacity.
+			const auto newEndIndex = ring.writeIndex.load(std::memory_order_acquire);
+			const auto firstValidIndex = newEndIndex >= capacity ? newEndIndex - capacity + 1 : 0;
+			const auto skip =
+				std::min<std::uint64_t>(firstValidIndex > nextIndex ? firstValidIndex - nextIndex : 0, count);
+
+			for (auto event = events.begin() + static_cast<std::ptrdiff_t>(skip); event != events.end(); ++event)
+			{
+				const std::string_view correlationId(event->correlationId.data(), event->correlationId.size());
+				const auto name = STAGE_NAMES[std::to_underlying(event->stage)];
+
+				// Async begin/end pairs group the stages of a payment, whatever threads recorded them.
+				for (const auto phase : {'b', 'e'})
+				{
+					std::format_to(std::back_inserter(out),
+						R"({}{{"name":"{}","cat":"payment","ph":"{}","id":"{}","pid":{},"tid":{},"ts":{:.3f})",
+						first ? "" : ",", name, phase, correlationId, Config::instanceId, ring.threadId,
+						(phase == 'b' ? event->startNanos : event->endNanos) / 1000.0);
+
+					if (phase == 'b' && event->gateway != PaymentGateway::SIZE)
+					{
+						std::format_to(std::back_inserter(out), R"(,"args":{{"gateway":"{}","httpStatus":{}}})",
+							event->gateway == PaymentGateway::DEFAULT ? "default" : "fallback", event->httpStatus);
+					}
+
+					out += '}';
+					first = false;
+				}
+			}
+
+			nextIndex += count;
+			written += count;
+
+			// Already overwritten ones are skipped without being copied.
+			nextIndex = std::max(nextIndex, std::min(firstValidIndex, endIndex));
+
+			if (nextIndex >= endIndex)
+			{
+				++ringIndex;
+				ringStarted = false;
+			}
+		}
+
+		if (ringIndex < rings.size())
+			return true;
+
+		out += "]}";
+
+		return false;
+	}
+}  // namespace rinhaback::api
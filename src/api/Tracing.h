@@ -0,0 +1,99 @@
+#pragma once
+
+#include "./Config.h"
+#include "./Database.h"
+#include "./Util.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace rinhaback::api
+{
+	// Opt-in (TRACING=true) per-payment stage tracing. Each thread stamps events in its own lock-free ring of
+	// TRACING_BUFFER_SIZE events, and ChromeJsonWriter exports all the rings in the Chrome trace event format, which
+	// Perfetto and chrome://tracing open. Every payment becomes an async track keyed by its correlation id.
+	// When disabled, recording costs a branch on the runtime Config::tracing flag.
+	class Tracing final
+	{
+	public:
+		enum class Stage : std::uint8_t
+		{
+			RECEIVE,
+			QUEUE_WAIT,
+			UPSTREAM_CALL,
+			RETRY_BACKOFF,
+			COMMIT
+		};
+
+		struct Event
+		{
+			std::int64_t startNanos;
+			std::int64_t endNanos;
+			CorrelationId correlationId;
+			std::int16_t httpStatus;
+			Stage stage;
+			PaymentGateway gateway;
+		};
+
+	public:
+		struct Ring;  // defined in Tracing.cpp
+
+		// Writes the events of all the threads of this process as a Chrome trace JSON document, a few events at a
+		// time, so the document can be streamed without building it all at once.
+		class ChromeJsonWriter final
+		{
+		public:
+			ChromeJsonWriter();
+
+			ChromeJsonWriter(const ChromeJsonWriter&) = delete;
+			ChromeJsonWriter& operator=(const ChromeJsonWriter&) = delete;
+
+		public:
+			// Appends up to maxEvents more events to out. Returns false once the end of the document was appended, after
+			// which it must not be called again.
+			bool write(std::string& out, std::size_t maxEvents);
+
+		private:
+			std::vector<std::shared_ptr<Ring>> rings;
+			std::size_t ringIndex = 0;
+			std::uint64_t nextIndex = 0;
+			std::uint64_t endIndex = 0;  // of the current ring, when it was started
+			bool ringStarted = false;
+			bool started = false;
+			bool first = true;
+			std::vector<Event> events;
+		};
+
+	public:
+		Tracing() = delete;
+
+	public:
+		static bool isEnabled()
+		{
+			return Config::tracing;
+		}
+
+		// Times are steady clock nanoseconds (getSteadyNanos()).
+		static void record(Stage stage, const CorrelationId& correlationId, std::int64_t startNanos,
+			std::int64_t endNanos, PaymentGateway gateway = PaymentGateway::SIZE, int httpStatus = 0)
+		{
+			if (isEnabled())
+			{
+				recordEvent(Event{
+					.startNanos = startNanos,
+					.endNanos = endNanos,
+					.correlationId = correlationId,
+					.httpStatus = static_cast<std::int16_t>(httpStatus),
+					.stage = stage,
+					.gateway = gateway,
+				});
+			}
+		}
+
+	private:
+		static void recordEvent(const Event& event);
+	};
+}  // namespace rinhaback::api
@@ -0,0 +1,171 @@
+#include "./TrafficLog.h"
+#include "./Config.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <experimental/scope>
+
+
+namespace rinhaback::api
+{
+	static std::int64_t getSystemMicros()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	}
+
+	TrafficLog::Writer::Writer(const std::string& path)
+		: file(std::fopen(path.c_str(), "wb")),
+		  lastTimeMicros(getSystemMicros())
+	{
+		if (!file)
+			throw std::system_error(errno, std::generic_category(), "Cannot create the traffic record " + path);
+
+		std::setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+
+		const std::uint32_t header[] = {VERSION, 0};
+		std::fwrite(MAGIC, sizeof(MAGIC), 1, file);
+		std::fwrite(header, sizeof(header), 1, file);
+		std::fwrite(&lastTimeMicros, sizeof(lastTimeMicros), 1, file);
+	}
+
+	TrafficLog::Writer::~Writer()
+	{
+		std::fclose(file);
+	}
+
+	void TrafficLog::Writer::append(const Record& record)
+	{
+		std::array<char, 64> buffer;
+		auto out = buffer.begin();
+
+		const auto put = [&](const auto& value)
+		{
+			std::memcpy(out, &value, sizeof(value));
+			out += sizeof(value);
+		};
+
+		put(record.kind);
+		out += sizeof(std::uint32_t);  // delta, known under the lock
+
+		if (record.kind == Kind::PAYMENT)
+		{
+			put(record.amount);
+			put(record.correlationId);
+		}
+		else
+		{
+			put(static_cast<std::uint8_t>((record.from ? FLAG_FROM : 0) | (record.to ? FLAG_TO : 0)));
+
+			if (record.from)
+				put(record.from.value());
+
+			if (record.to)
+				put(record.to.value());
+		}
+
+		std::unique_lock lock(mutex);
+
+		const auto timeMicros = std::max(getSystemMicros(), lastTimeMicros);
+		// Gaps over ~71 minutes are shortened.
+		const auto delta = static_cast<std::uint32_t>(
+			std::min<std::int64_t>(timeMicros - lastTimeMicros, std::numeric_limits<std::uint32_t>::max()));
+		lastTimeMicros = timeMicros;
+
+		std::memcpy(buffer.begin() + sizeof(Kind), &delta, sizeof(delta));
+		std::fwrite(buffer.data(), static_cast<std::size_t>(out - buffer.begin()), 1, file);
+	}
+
+	TrafficLog::Writer* TrafficLog::getWriter()
+	{
+		static const std::unique_ptr<Writer> writer =
+			Config::trafficRecord.empty() ? nullptr : std::make_unique<Writer>(Config::trafficRecord);
+
+		return writer.get();
+	}
+
+	void TrafficLog::recordPayment(double amount, const CorrelationId& correlationId)
+	{
+		if (const auto writer = getWriter())
+			writer->append(Record{.kind = Kind::PAYMENT, .amount = amount, .correlationId = correlationId});
+	}
+
+	void TrafficLog::recordSummary(std::optional<DateTimeMillis> from, std::optional<DateTimeMillis> to)
+	{
+		if (const auto writer = getWriter())
+		{
+			writer->append(Record{
+				.kind = Kind::SUMMARY,
+				.from = from ? std::make_optional(from->time_since_epoch().count()) : std::nullopt,
+				.to = to ? std::make_optional(to->time_since_epoch().count()) : std::nullopt,
+			});
+		}
+	}
+
+	std::vector<TrafficLog::Record> TrafficLog::read(const std::string& path)
+	{
+		const auto file = std::fopen(path.c_str(), "rb");
+
+		if (!file)
+			throw std::system_error(errno, std::generic_category(), "Cannot open the traffic record " + path);
+
+		std::experimental::scope_exit scopeExit([&]() { std::fclose(file); });
+
+		const auto get = [&](auto& value) { return std::fread(&value, sizeof(value), 1, file) == 1; };
+
+		char magic[sizeof(MAGIC)];
+		std::uint32_t header[2];
+		std::int64_t timeMicros;
+
+		if (!get(magic) || !get(header) || !get(timeMicros) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+			header[0] != VERSION)
+		{
+			throw std::runtime_error("Invalid traffic record " + path);
+		}
+
+		std::vector<Record> records;
+
+		// A truncated last record (killed process) is ignored.
+		while (true)
+		{
+			Record record;
+			std::uint32_t delta;
+
+			if (!get(record.kind) || !get(delta))
+				break;
+
+			timeMicros += delta;
+			record.timeMicros = timeMicros;
+
+			if (record.kind == Kind::PAYMENT)
+			{
+				if (!get(record.amount) || !get(record.correlationId))
+					break;
+			}
+			else if (record.kind == Kind::SUMMARY)
+			{
+				std::uint8_t flags;
+				std::int64_t from, to;
+
+				if (!get(flags) || ((flags & FLAG_FROM) && !get(from)) || ((flags & FLAG_TO) && !get(to)))
+					break;
+
+				record.from = (flags & FLAG_FROM) ? std::make_optional(from) : std::nullopt;
+				record.to = (flags & FLAG_TO) ? std::make_optional(to) : std::nullopt;
+			}
+			else
+				throw std::runtime_error("Invalid record kind in traffic record " + path);
+
+			records.push_back(record);
+		}
+
+		return records;
+	}
+}  // namespace rinhaback::api
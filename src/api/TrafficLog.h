@@ -0,0 +1,77 @@
+#pragma once
+
+#include "./Database.h"
+#include "./Util.h"
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+
+namespace rinhaback::api
+{
+	// Compact binary log of the requests received by the API (TRAFFIC_RECORD), replayed by the load generator.
+	// The file starts with a header (magic, version, system clock microseconds of the start) followed by records of a
+	// kind byte and the microseconds since the previous record (uint32), then:
+	// - PAYMENT: amount (double) and correlationId (36 chars);
+	// - SUMMARY: flags (bit 0: from, bit 1: to) and the present from/to (int64 milliseconds since epoch).
+	// All in native byte order.
+	class TrafficLog final
+	{
+	public:
+		enum class Kind : std::uint8_t
+		{
+			PAYMENT,
+			SUMMARY
+		};
+
+		struct Record
+		{
+			std::int64_t timeMicros;  // system clock
+			Kind kind;
+			double amount = 0;
+			CorrelationId correlationId{};
+			std::optional<std::int64_t> from;
+			std::optional<std::int64_t> to;
+		};
+
+		class Writer final
+		{
+		public:
+			explicit Writer(const std::string& path);
+			~Writer();
+
+			Writer(const Writer&) = delete;
+			Writer& operator=(const Writer&) = delete;
+
+		public:
+			void append(const Record& record);
+
+		private:
+			std::mutex mutex;
+			FILE* file;
+			std::int64_t lastTimeMicros;
+		};
+
+	public:
+		TrafficLog() = delete;
+
+	public:
+		// The TRAFFIC_RECORD writer of this process, or nullptr when not recording.
+		static Writer* getWriter();
+
+		static void recordPayment(double amount, const CorrelationId& correlationId);
+		static void recordSummary(std::optional<DateTimeMillis> from, std::optional<DateTimeMillis> to);
+
+		// Reads all the records of a log, with their absolute times.
+		static std::vector<Record> read(const std::string& path);
+
+	private:
+		static inline constexpr char MAGIC[8] = {'R', 'I', 'N', 'H', 'A', 'T', 'R', 'F'};
+		static inline constexpr std::uint32_t VERSION = 1;
+		static inline constexpr std::uint8_t FLAG_FROM = 1;
+		static inline constexpr std::uint8_t FLAG_TO = 2;
+	};
+}  // namespace rinhaback::api
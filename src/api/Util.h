@@ -1,8 +1,12 @@
 #pragma once
 
 #include <chrono>
-#include <sstream>
+#include <cmath>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <cstddef>
 #include <cstdint>
 
 
@@ -11,6 +15,7 @@ namespace rinhaback::api
 	inline constexpr int HTTP_STATUS_OK = 200;
 	inline constexpr int HTTP_STATUS_UNPROCESSABLE_CONTENT = 422;
 	inline constexpr int HTTP_STATUS_INTERNAL_SERVER_ERROR = 500;
+	inline constexpr int HTTP_STATUS_SERVICE_UNAVAILABLE = 503;
 
 	inline const std::string HTTP_CONTENT_TYPE_JSON = "application/json";
 
@@ -26,16 +31,204 @@ namespace rinhaback::api
 		return getCurrentDateTime().time_since_epoch().count();
 	}
 
-	inline DateTimeMillis parseDateTime(const std::string& str)
+	// Amounts are stored as integer cents, so sums are exact.
+	inline std::int64_t toCents(double amount)
 	{
-		DateTimeMillis dateTime;
+		return std::llround(amount * 100);
+	}
 
-		std::istringstream iss{str};
-		std::chrono::from_stream(iss, "%FT%T%Z", dateTime);
+	// Steady clock nanoseconds. It's the system-wide CLOCK_MONOTONIC, so values are comparable between instances.
+	inline std::int64_t toSteadyNanos(std::chrono::steady_clock::time_point timePoint)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint.time_since_epoch()).count();
+	}
 
-		if (iss.fail())
-			throw std::invalid_argument("Invalid date time: " + str);
+	inline std::int64_t getSteadyNanos()
+	{
+		return toSteadyNanos(std::chrono::steady_clock::now());
+	}
+
+	// Days since 1970-01-01 of a proleptic Gregorian date (Howard Hinnant's days_from_civil).
+	constexpr std::int64_t daysFromCivil(std::int64_t year, unsigned month, unsigned day) noexcept
+	{
+		year -= month <= 2;
+		const std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+		const auto yearOfEra = static_cast<unsigned>(year - era * 400);
+		const unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+		const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
 
-		return dateTime;
+		return era * 146097 + static_cast<std::int64_t>(dayOfEra) - 719468;
 	}
+
+	// Parses YYYY-MM-DDTHH:MM:SS[.fraction][Z|+HH:MM|-HH:MM|+HHMM|-HHMM], without time zone meaning UTC.
+	// Fractions beyond milliseconds are truncated.
+	constexpr std::optional<DateTimeMillis> tryParseDateTime(std::string_view str) noexcept
+	{
+		std::size_t pos = 0;
+
+		const auto digits = [&](std::size_t count, unsigned& value)
+		{
+			if (str.size() - pos < count)
+				return false;
+
+			value = 0;
+
+			for (std::size_t i = 0; i < count; ++i, ++pos)
+			{
+				if (str[pos] < '0' || str[pos] > '9')
+					return false;
+
+				value = value * 10 + static_cast<unsigned>(str[pos] - '0');
+			}
+
+			return true;
+		};
+
+		const auto literal = [&](char c)
+		{
+			if (pos < str.size() && str[pos] == c)
+			{
+				++pos;
+				return true;
+			}
+
+			return false;
+		};
+
+		unsigned year, month, day, hour, minute, second;
+
+		if (!digits(4, year) || !literal('-') || !digits(2, month) || !literal('-') || !digits(2, day) ||
+			!(literal('T') || literal('t') || literal(' ')) || !digits(2, hour) || !literal(':') ||
+			!digits(2, minute) || !literal(':') || !digits(2, second))
+		{
+			return std::nullopt;
+		}
+
+		constexpr unsigned char DAYS_IN_MONTH[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+		if (month < 1 || month > 12 || day < 1 || day > DAYS_IN_MONTH[month - 1] || hour > 23 || minute > 59 ||
+			second > 60)
+		{
+			return std::nullopt;
+		}
+
+		if (month == 2 && day == 29 && (year % 4 != 0 || (year % 100 == 0 && year % 400 != 0)))
+			return std::nullopt;
+
+		unsigned millis = 0;
+
+		if (literal('.'))
+		{
+			std::size_t fractionDigits = 0;
+
+			while (pos < str.size() && str[pos] >= '0' && str[pos] <= '9')
+			{
+				if (fractionDigits++ < 3)
+					millis = millis * 10 + static_cast<unsigned>(str[pos] - '0');
+
+				++pos;
+			}
+
+			if (fractionDigits == 0)
+				return std::nullopt;
+
+			for (; fractionDigits < 3; ++fractionDigits)
+				millis *= 10;
+		}
+
+		std::int64_t offsetMinutes = 0;
+
+		if (pos < str.size() && !literal('Z') && !literal('z'))
+		{
+			if (str[pos] != '+' && str[pos] != '-')
+				return std::nullopt;
+
+			const bool negative = str[pos++] == '-';
+			unsigned offsetHour, offsetMinute;
+
+			if (!digits(2, offsetHour))
+				return std::nullopt;
+
+			literal(':');
+
+			if (!digits(2, offsetMinute) || offsetHour > 23 || offsetMinute > 59)
+				return std::nullopt;
+
+			offsetMinutes = (negative ? -1 : 1) * static_cast<std::int64_t>(offsetHour * 60 + offsetMinute);
+		}
+
+		if (pos != str.size())
+			return std::nullopt;
+
+		const std::int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second -
+			offsetMinutes * 60;
+
+		return DateTimeMillis(std::chrono::milliseconds(seconds * 1000 + millis));
+	}
+
+	inline DateTimeMillis parseDateTime(std::string_view str)
+	{
+		if (const auto dateTime = tryParseDateTime(str))
+			return dateTime.value();
+
+		throw std::invalid_argument("Invalid date time: " + std::string(str));
+	}
+
+	// Formats as YYYY-MM-DDTHH:MM:SS.mmmZ, returning the end of the written chars.
+	constexpr char* formatDateTime(DateTimeMillis dateTime, char* out) noexcept
+	{
+		const std::int64_t totalMillis = dateTime.time_since_epoch().count();
+		std::int64_t days = totalMillis / 86400000;
+		std::int64_t millisOfDay = totalMillis % 86400000;
+
+		if (millisOfDay < 0)
+		{
+			millisOfDay += 86400000;
+			--days;
+		}
+
+		// Howard Hinnant's civil_from_days.
+		days += 719468;
+		const std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+		const auto dayOfEra = static_cast<unsigned>(days - era * 146097);
+		const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+		const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+		const unsigned monthPrime = (5 * dayOfYear + 2) / 153;
+		const unsigned day = dayOfYear - (153 * monthPrime + 2) / 5 + 1;
+		const unsigned month = monthPrime < 10 ? monthPrime + 3 : monthPrime - 9;
+		const auto year = static_cast<unsigned>(static_cast<std::int64_t>(yearOfEra) + era * 400 + (month <= 2));
+
+		const auto put = [&](unsigned value, unsigned width)
+		{
+			for (unsigned i = width; i > 0; --i)
+			{
+				out[i - 1] = static_cast<char>('0' + value % 10);
+				value /= 10;
+			}
+
+			out += width;
+		};
+
+		const auto millis = static_cast<unsigned>(millisOfDay % 1000);
+		const auto secondsOfDay = static_cast<unsigned>(millisOfDay / 1000);
+
+		put(year, 4);
+		*out++ = '-';
+		put(month, 2);
+		*out++ = '-';
+		put(day, 2);
+		*out++ = 'T';
+		put(secondsOfDay / 3600, 2);
+		*out++ = ':';
+		put(secondsOfDay / 60 % 60, 2);
+		*out++ = ':';
+		put(secondsOfDay % 60, 2);
+		*out++ = '.';
+		put(millis, 3);
+		*out++ = 'Z';
+
+		return out;
+	}
+
+	inline constexpr std::size_t DATE_TIME_FORMATTED_LENGTH = 24;
 }  // namespace rinhaback::api
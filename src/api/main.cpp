@@ -1,39 +1,100 @@
 #include "mimalloc-new-delete.h"
 #include "./PaymentProcessor.h"
+#include "./AsyncPaymentProcessor.h"
+#include "./ConcurrencyLimiter.h"
 #include "./Config.h"
+#include "./CpuAffinity.h"
 #include "./GatewayChooserService.h"
+#include "./Listener.h"
+#include "./Metrics.h"
+#include "./PaymentMirror.h"
+#include "./PaymentRequestParser.h"
 #include "./PendingPaymentsQueue.h"
+#include "./RetryScheduler.h"
+#include "./SharedMemory.h"
 #include "./SignalHandling.h"
+#include "./SummaryExecutor.h"
+#include "./Tracing.h"
+#include "./TrafficLog.h"
 #include "./Util.h"
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <exception>
-#include <format>
 #include <memory>
 #include <optional>
 #include <print>
-#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <vector>
+#include <cstdint>
+#include <cstring>
 #include <experimental/scope>
 #include "mongoose.h"
-#include "yyjson.h"
 
 
 namespace rinhaback::api
 {
 	static constexpr auto RESPONSE_HEADERS = "Content-Type: application/json\r\n";
+	static constexpr auto METRICS_RESPONSE_HEADERS = "Content-Type: text/plain; version=0.0.4\r\n";
+	static constexpr auto METRICS_PUBLISH_INTERVAL = std::chrono::milliseconds(100);
+	static constexpr std::size_t TRACE_CHUNK_EVENTS = 256;
+	static constexpr std::size_t TRACE_SEND_BUFFER_LIMIT = 64 * 1024;
 
 	static const auto MG_GET = mg_str("GET");
 	static const auto MG_POST = mg_str("POST");
 	static const auto MG_PURGE_PAYMENTS_PATH = mg_str("/purge-payments");
 	static const auto MG_PAYMENTS_SUMMARY_PATH = mg_str("/payments-summary");
 	static const auto MG_PAYMENTS_PATH = mg_str("/payments");
+	static const auto MG_METRICS_PATH = mg_str("/metrics");
+	static const auto MG_TRACE_PATH = mg_str("/trace");
 
 	static std::shared_ptr<PaymentService> paymentService{std::make_shared<PaymentService>()};
-	static std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue{std::make_shared<PendingPaymentsQueue>()};
+	static std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
+	static std::shared_ptr<RetryScheduler> retryScheduler;
+	static std::shared_ptr<SummaryExecutor> summaryExecutor;
+
+	// The /trace writer of a connection is kept in its user data, null when not streaming one.
+	static Tracing::ChromeJsonWriter* getTraceWriter(const mg_connection* conn)
+	{
+		Tracing::ChromeJsonWriter* writer;
+		static_assert(sizeof(writer) <= sizeof(conn->data));
+
+		std::memcpy(&writer, conn->data, sizeof(writer));
+		return writer;
+	}
+
+	static void setTraceWriter(mg_connection* conn, Tracing::ChromeJsonWriter* writer)
+	{
+		std::memcpy(conn->data, &writer, sizeof(writer));
+	}
+
+	// /trace is streamed a chunk at a time from MG_EV_POLL and MG_EV_WRITE, so exporting all the rings doesn't stall
+	// the other connections of the server thread.
+	static void writeTraceChunk(mg_connection* conn)
+	{
+		const auto writer = getTraceWriter(conn);
+
+		if (!writer || conn->send.len > TRACE_SEND_BUFFER_LIMIT)
+			return;
+
+		std::string chunk;
+		const bool hasMore = writer->write(chunk, TRACE_CHUNK_EVENTS);
+
+		mg_http_write_chunk(conn, chunk.data(), chunk.size());
+
+		if (!hasMore)
+		{
+			mg_http_write_chunk(conn, "", 0);
+			setTraceWriter(conn, nullptr);
+			delete writer;
+
+			// Requests which arrived during the stream were not answered, so close the connection.
+			conn->is_draining = 1;
+		}
+	}
 
 	static void httpHandler(mg_connection* conn, int ev, void* evData)
 	{
@@ -45,6 +106,10 @@ namespace rinhaback::api
 
 		try
 		{
+			// A reply would land in the middle of the /trace stream.
+			if (ev == MG_EV_HTTP_MSG && getTraceWriter(conn))
+				return;
+
 			if (ev == MG_EV_HTTP_MSG)
 			{
 				const auto httpMessage = static_cast<mg_http_message*>(evData);
@@ -54,9 +119,14 @@ namespace rinhaback::api
 				if (isGet && mg_match(httpMessage->uri, MG_PAYMENTS_SUMMARY_PATH, nullptr))
 				{
 					Response response;
+					bool deferred = false;
 
-					std::experimental::scope_exit scopeExit([&]()
-						{ mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "%s", response.json.begin()); });
+					std::experimental::scope_exit scopeExit(
+						[&]()
+						{
+							if (!deferred)
+								mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "%s", response.json.begin());
+						});
 
 					std::optional<DateTimeMillis> from, to;
 					char queryParamBuffer[100];
@@ -67,62 +137,87 @@ namespace rinhaback::api
 					if (mg_http_get_var(&httpMessage->query, "to", queryParamBuffer, sizeof(queryParamBuffer)) > 0)
 						to = parseDateTime(queryParamBuffer);
 
-					const auto summary = paymentService->getPaymentsSummary(from, to);
-
-					const auto& defaultGateway = summary.defaultGateway;
-					const auto& fallbackGateway = summary.fallbackGateway;
+					TrafficLog::recordSummary(from, to);
 
-					std::format_to_n(response.json.begin(), response.json.size(),
-						R"({{"default":{{"totalRequests":{},"totalAmount":{:.2f}}},)"
-						R"("fallback":{{"totalRequests":{},"totalAmount":{:.2f}}}}})",
-						defaultGateway.totalRequests, defaultGateway.totalAmount, fallbackGateway.totalRequests,
-						fallbackGateway.totalAmount);
-
-					response.statusCode = HTTP_STATUS_OK;
+					if (summaryExecutor)
+					{
+						// Replied in MG_EV_WAKEUP.
+						summaryExecutor->submit(conn->mgr, conn->id, from, to);
+						deferred = true;
+					}
+					else
+					{
+						SummaryExecutor::formatSummary(response.json, paymentService->getPaymentsSummary(from, to));
+						response.statusCode = HTTP_STATUS_OK;
+					}
 				}
 				else if (isPost && mg_match(httpMessage->uri, MG_PAYMENTS_PATH, nullptr))
 				{
+					const auto receivedAt = Tracing::isEnabled() ? getSteadyNanos() : 0;
+
 					Response response;
 					response.statusCode = HTTP_STATUS_UNPROCESSABLE_CONTENT;
 
-					const auto inDocJson = yyjson_read(httpMessage->body.buf, httpMessage->body.len, 0);
-
 					std::experimental::scope_exit scopeExit(
 						[&]()
 						{
 							if (response.statusCode != HTTP_STATUS_OK)
 								mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "");
-
-							yyjson_doc_free(inDocJson);
 						});
 
-					const auto inRootJson = yyjson_doc_get_root(inDocJson);
-					const auto correlationIdJson = yyjson_obj_get(inRootJson, "correlationId");
-					const auto amountJson = yyjson_obj_get(inRootJson, "amount");
+					const auto paymentRequest =
+						PaymentRequestParser::parse(std::string_view(httpMessage->body.buf, httpMessage->body.len));
+
+					if (paymentRequest.has_value())
+						TrafficLog::recordPayment(paymentRequest->amount, paymentRequest->correlationId);
 
-					if (yyjson_is_str(correlationIdJson) && yyjson_is_num(amountJson))
+					if (paymentRequest.has_value() && paymentRequest->amount > 0)
 					{
-						const std::span correlationId(
-							yyjson_get_str(correlationIdJson), yyjson_get_len(correlationIdJson));
-						const auto amount = yyjson_get_num(amountJson);
+						const PendingPaymentsQueue::Payment pendingPayment = {
+							.amount = paymentRequest->amount,
+							.correlationId = paymentRequest->correlationId,
+						};
 
-						if (correlationId.size() == std::tuple_size<CorrelationId>() && amount > 0)
+						if (pendingPaymentsQueue->enqueue(pendingPayment))
 						{
 							response.statusCode = HTTP_STATUS_OK;
 							mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "");
+							Metrics::increment(Metrics::Counter::PAYMENTS_RECEIVED);
 
-							PendingPaymentsQueue::Payment pendingPayment = {.amount = amount};
-							std::copy_n(correlationId.data(), pendingPayment.correlationId.size(),
-								pendingPayment.correlationId.begin());
-
-							pendingPaymentsQueue->enqueue(pendingPayment);
+							if (Tracing::isEnabled())
+							{
+								Tracing::record(Tracing::Stage::RECEIVE, pendingPayment.correlationId, receivedAt,
+									getSteadyNanos());
+							}
+						}
+						else
+						{
+							response.statusCode = HTTP_STATUS_SERVICE_UNAVAILABLE;
+							Metrics::increment(Metrics::Counter::PAYMENTS_REJECTED);
 						}
 					}
 				}
+				else if (isGet && mg_match(httpMessage->uri, MG_METRICS_PATH, nullptr))
+				{
+					const auto metrics = Metrics::format();
+					mg_http_reply(conn, HTTP_STATUS_OK, METRICS_RESPONSE_HEADERS, "%.*s",
+						static_cast<int>(metrics.size()), metrics.data());
+				}
+				else if (isGet && Tracing::isEnabled() && mg_match(httpMessage->uri, MG_TRACE_PATH, nullptr))
+				{
+					mg_printf(conn, "HTTP/1.1 %d OK\r\n%sTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n",
+						HTTP_STATUS_OK, RESPONSE_HEADERS);
+					setTraceWriter(conn, new Tracing::ChromeJsonWriter());
+
+					// Don't read more requests while streaming.
+					conn->is_full = 1;
+					writeTraceChunk(conn);
+				}
 				else if (isPost && mg_match(httpMessage->uri, MG_PURGE_PAYMENTS_PATH, nullptr))
 				{
 					paymentService->purge();
 					pendingPaymentsQueue->purge();
+					retryScheduler->purge();
 
 					mg_http_reply(conn, HTTP_STATUS_OK, RESPONSE_HEADERS, "");
 				}
@@ -132,6 +227,23 @@ namespace rinhaback::api
 						MG_ESC("error"), MG_ESC("Unsupported URI"));
 				}
 			}
+			else if (ev == MG_EV_WAKEUP)
+			{
+				// Summary computed by the SummaryExecutor. An empty message means it failed.
+				const auto json = static_cast<const mg_str*>(evData);
+
+				if (json->len > 0)
+				{
+					mg_http_reply(
+						conn, HTTP_STATUS_OK, RESPONSE_HEADERS, "%.*s", static_cast<int>(json->len), json->buf);
+				}
+				else
+					mg_http_reply(conn, HTTP_STATUS_INTERNAL_SERVER_ERROR, RESPONSE_HEADERS, "{}");
+			}
+			else if (ev == MG_EV_POLL || ev == MG_EV_WRITE)
+				writeTraceChunk(conn);
+			else if (ev == MG_EV_CLOSE)
+				delete getTraceWriter(conn);
 		}
 		catch (const std::exception& e)
 		{
@@ -147,35 +259,99 @@ namespace rinhaback::api
 	{
 		SignalHandling::install();
 
+		getSharedData();
+		pendingPaymentsQueue = PendingPaymentsQueue::create();
+
+		// Rebuilt from LMDB before any payment may be committed.
+		PaymentMirror::get();
+
+		// Managers outlive all threads, as summary executors may still wake them up while the servers finish.
+		std::vector<mg_mgr> serverManagers(Config::serverWorkers);
+
+		for (auto& mgr : serverManagers)
+		{
+			mg_mgr_init(&mgr);
+
+			if (Config::summaryWorkers > 0 && !mg_wakeup_init(&mgr))
+				throw std::runtime_error("Cannot initialize mongoose wakeup.");
+		}
+
+		std::experimental::scope_exit serverManagersFree(
+			[&]()
+			{
+				for (auto& mgr : serverManagers)
+					mg_mgr_free(&mgr);
+			});
+
+		// Declared before the other threads so it's joined after the processors finished posting payments.
+		std::jthread committerThread = PaymentService::start(paymentService);
+
 		std::vector<std::jthread> threads;
-		threads.reserve(1 + Config::processorWorkers + Config::serverWorkers);
+		threads.reserve(2 + Config::processorWorkers + Config::summaryWorkers + Config::serverWorkers);
+
+		threads.emplace_back(GatewayChooserService::start());
 
-		if (Config::databaseInit)
-			threads.emplace_back(GatewayChooserService::start());
+		retryScheduler = std::make_shared<RetryScheduler>(pendingPaymentsQueue);
+		threads.emplace_back(RetryScheduler::start(retryScheduler));
 
 		for (unsigned i = 0; i < Config::processorWorkers; ++i)
-			threads.emplace_back(PaymentProcessor::start(pendingPaymentsQueue, paymentService));
+		{
+			if (Config::processorAsync)
+			{
+				threads.emplace_back(
+					AsyncPaymentProcessor::start(pendingPaymentsQueue, retryScheduler, paymentService));
+			}
+			else
+				threads.emplace_back(PaymentProcessor::start(pendingPaymentsQueue, retryScheduler, paymentService));
+
+			CpuAffinity::pin(threads.back(), Config::processorCpus, i);
+		}
+
+		if (Config::summaryWorkers > 0)
+		{
+			summaryExecutor = std::make_shared<SummaryExecutor>(paymentService);
+
+			for (unsigned i = 0; i < Config::summaryWorkers; ++i)
+				threads.emplace_back(SummaryExecutor::start(summaryExecutor));
+		}
+
+		Listener::listen(serverManagers, httpHandler);
 
 		for (unsigned i = 0; i < Config::serverWorkers; ++i)
 		{
 			threads.emplace_back(
-				[]
+				[&mgr = serverManagers[i]]
 				{
-					mg_mgr mgr;
-					mg_mgr_init(&mgr);
-					mg_http_listen(&mgr, Config::listenAddress.c_str(), httpHandler, nullptr);
-
 					while (!SignalHandling::shouldFinish())
 						mg_mgr_poll(&mgr, Config::serverPollTime);
-
-					mg_mgr_free(&mgr);
 				});
+
+			CpuAffinity::pin(threads.back(), Config::serverCpus, i);
 		}
 
 		getConnection();
 
 		std::println("Server listening on {}", Config::listenAddress);
 
+		// Publish the heartbeat and gauges of this instance and watch the shared queue while the other threads work.
+		while (!SignalHandling::shouldFinish())
+		{
+			getSharedData().instances[Config::instanceId].heartbeat.store(getSteadyNanos(), std::memory_order_relaxed);
+			Metrics::set(Metrics::Gauge::QUEUE_DEPTH, static_cast<std::int64_t>(pendingPaymentsQueue->getDepth()));
+			pendingPaymentsQueue->recoverAbandoned();
+
+			for (const auto gateway : {PaymentGateway::DEFAULT, PaymentGateway::FALLBACK})
+			{
+				const auto& limiter = ConcurrencyLimiter::get(gateway);
+
+				Metrics::set(
+					Metrics::forGateway(Metrics::Gauge::CONCURRENCY_LIMIT_DEFAULT, gateway), limiter.getLimit());
+				Metrics::set(Metrics::forGateway(Metrics::Gauge::IN_FLIGHT_DEFAULT, gateway), limiter.getInFlight());
+			}
+
+			std::this_thread::sleep_for(METRICS_PUBLISH_INTERVAL);
+		}
+
 		threads.clear();
 
 		std::println("Exiting");
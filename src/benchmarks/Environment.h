@@ -0,0 +1,10 @@
+#pragma once
+
+#include <filesystem>
+
+
+namespace rinhaback::benchmarks
+{
+	// Directory created for the databases of this run, removed when the benchmarks finish.
+	const std::filesystem::path& getTemporaryDirectory();
+}  // namespace rinhaback::benchmarks
@@ -0,0 +1,44 @@
+#include "../api/PaymentService.h"
+#include "../api/SummaryExecutor.h"
+#include "../api/Util.h"
+#include <array>
+#include <chrono>
+#include "benchmark/benchmark.h"
+
+
+namespace rinhaback::benchmarks
+{
+	using namespace rinhaback::api;
+
+	static void BM_SummaryExecutor_FormatSummary(benchmark::State& state)
+	{
+		const PaymentService::PaymentsSummaryResponse summary = {
+			.defaultGateway = {.totalRequests = 123'456, .totalAmountCents = 245'677'440},
+			.fallbackGateway = {.totalRequests = 7'890, .totalAmountCents = 15'701'100},
+		};
+		std::array<char, 2000> buffer;
+
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(SummaryExecutor::formatSummary(buffer, summary));
+			benchmark::ClobberMemory();
+		}
+	}
+
+	BENCHMARK(BM_SummaryExecutor_FormatSummary);
+
+	static void BM_FormatDateTime(benchmark::State& state)
+	{
+		auto dateTime = DateTimeMillis(std::chrono::milliseconds(1'752'582'896'789));
+		std::array<char, 32> buffer;
+
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(dateTime);
+			benchmark::DoNotOptimize(formatDateTime(dateTime, buffer.data()));
+			benchmark::ClobberMemory();
+		}
+	}
+
+	BENCHMARK(BM_FormatDateTime);
+}  // namespace rinhaback::benchmarks
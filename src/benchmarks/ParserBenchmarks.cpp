@@ -0,0 +1,104 @@
+#include "../api/PaymentRequestParser.h"
+#include "../api/Util.h"
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include "benchmark/benchmark.h"
+#include "yyjson.h"
+
+
+namespace rinhaback::benchmarks
+{
+	using namespace rinhaback::api;
+
+	static constexpr std::string_view PAYMENT_BODY =
+		R"({"correlationId": "4a7901b8-7d26-4d9d-aa19-4dc1c7cf60b3", "amount": 19.90})";
+
+	// Valid, but out of the fast parser schema (other key), so parse() falls back to yyjson.
+	static constexpr std::string_view EXTENDED_PAYMENT_BODY =
+		R"({"correlationId": "4a7901b8-7d26-4d9d-aa19-4dc1c7cf60b3", "amount": 19.90, "note": "x"})";
+
+	static constexpr std::string_view DATE_TIME = "2025-07-15T12:34:56.789Z";
+	static constexpr std::string_view DATE_TIME_WITH_OFFSET = "2025-07-15T09:34:56.789-03:00";
+
+	// The parsing of POST /payments before PaymentRequestParser: a heap allocated yyjson document per request and
+	// key lookups by name.
+	static std::optional<PaymentRequestParser::PaymentRequest> parseBaseline(std::string_view body)
+	{
+		const auto inDocJson = yyjson_read(body.data(), body.size(), 0);
+		std::optional<PaymentRequestParser::PaymentRequest> result;
+
+		const auto inRootJson = yyjson_doc_get_root(inDocJson);
+		const auto correlationIdJson = yyjson_obj_get(inRootJson, "correlationId");
+		const auto amountJson = yyjson_obj_get(inRootJson, "amount");
+
+		if (yyjson_is_str(correlationIdJson) && yyjson_is_num(amountJson) &&
+			yyjson_get_len(correlationIdJson) == std::tuple_size<CorrelationId>())
+		{
+			result.emplace();
+			result->amount = yyjson_get_num(amountJson);
+			std::copy_n(yyjson_get_str(correlationIdJson), result->correlationId.size(), result->correlationId.begin());
+		}
+
+		yyjson_doc_free(inDocJson);
+
+		return result;
+	}
+
+	static void BM_PaymentRequestParser_Baseline(benchmark::State& state)
+	{
+		for (auto _ : state)
+			benchmark::DoNotOptimize(parseBaseline(PAYMENT_BODY));
+	}
+
+	BENCHMARK(BM_PaymentRequestParser_Baseline);
+
+	static void BM_PaymentRequestParser_Parse(benchmark::State& state)
+	{
+		for (auto _ : state)
+			benchmark::DoNotOptimize(PaymentRequestParser::parse(PAYMENT_BODY));
+	}
+
+	BENCHMARK(BM_PaymentRequestParser_Parse);
+
+	static void BM_PaymentRequestParser_ParseFast(benchmark::State& state)
+	{
+		for (auto _ : state)
+			benchmark::DoNotOptimize(PaymentRequestParser::parseFast(PAYMENT_BODY));
+	}
+
+	BENCHMARK(BM_PaymentRequestParser_ParseFast);
+
+	static void BM_PaymentRequestParser_ParseGeneric(benchmark::State& state)
+	{
+		for (auto _ : state)
+			benchmark::DoNotOptimize(PaymentRequestParser::parseGeneric(PAYMENT_BODY));
+	}
+
+	BENCHMARK(BM_PaymentRequestParser_ParseGeneric);
+
+	static void BM_PaymentRequestParser_ParseFallback(benchmark::State& state)
+	{
+		for (auto _ : state)
+			benchmark::DoNotOptimize(PaymentRequestParser::parse(EXTENDED_PAYMENT_BODY));
+	}
+
+	BENCHMARK(BM_PaymentRequestParser_ParseFallback);
+
+	static void BM_ParseDateTime(benchmark::State& state)
+	{
+		for (auto _ : state)
+			benchmark::DoNotOptimize(parseDateTime(DATE_TIME));
+	}
+
+	BENCHMARK(BM_ParseDateTime);
+
+	static void BM_ParseDateTimeWithOffset(benchmark::State& state)
+	{
+		for (auto _ : state)
+			benchmark::DoNotOptimize(parseDateTime(DATE_TIME_WITH_OFFSET));
+	}
+
+	BENCHMARK(BM_ParseDateTimeWithOffset);
+}  // namespace rinhaback::benchmarks
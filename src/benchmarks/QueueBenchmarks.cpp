@@ -0,0 +1,74 @@
+#include "../api/PendingPaymentsQueue.h"
+#include <array>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+#include "benchmark/benchmark.h"
+
+
+namespace rinhaback::benchmarks
+{
+	using namespace rinhaback::api;
+
+	static constexpr unsigned QUEUE_CAPACITY = 65536;
+
+	static PendingPaymentsQueue& getQueue()
+	{
+		static PendingPaymentsQueue queue(QUEUE_CAPACITY);
+		return queue;
+	}
+
+	static PendingPaymentsQueue::Payment makePayment()
+	{
+		PendingPaymentsQueue::Payment payment = {.amount = 19.90};
+		payment.correlationId.fill('a');
+		return payment;
+	}
+
+	// Every thread enqueues and dequeues, so producers and consumers contend for both ends of the ring.
+	static void BM_PendingPaymentsQueue_EnqueueDequeue(benchmark::State& state)
+	{
+		auto& queue = getQueue();
+		const auto payment = makePayment();
+
+		if (state.thread_index() == 0)
+			queue.purge();
+
+		for (auto _ : state)
+		{
+			queue.enqueue(payment);
+			benchmark::DoNotOptimize(queue.tryDequeue());
+		}
+
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	BENCHMARK(BM_PendingPaymentsQueue_EnqueueDequeue)->ThreadRange(1, 8)->UseRealTime();
+
+	// Producers enqueue one at a time while consumers take up to state.range(0) payments per CAS.
+	static void BM_PendingPaymentsQueue_BulkDequeue(benchmark::State& state)
+	{
+		auto& queue = getQueue();
+		const auto payment = makePayment();
+		const bool producer = state.thread_index() % 2 == 0;
+		std::array<PendingPaymentsQueue::Payment, 64> payments;
+		const auto bulk = std::span(payments).first(static_cast<std::size_t>(state.range(0)));
+		std::size_t dequeued = 0;
+
+		if (state.thread_index() == 0)
+			queue.purge();
+
+		for (auto _ : state)
+		{
+			if (producer)
+				benchmark::DoNotOptimize(queue.enqueue(payment));
+			else
+				dequeued += queue.tryDequeueBulk(bulk);
+		}
+
+		if (!producer)
+			state.SetItemsProcessed(static_cast<std::int64_t>(dequeued));
+	}
+
+	BENCHMARK(BM_PendingPaymentsQueue_BulkDequeue)->Arg(1)->Arg(16)->Arg(64)->ThreadRange(2, 8)->UseRealTime();
+}  // namespace rinhaback::benchmarks
@@ -0,0 +1,138 @@
+#include "./Environment.h"
+#include "../api/Database.h"
+#include "../api/PaymentRepository.h"
+#include "../api/Util.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "benchmark/benchmark.h"
+
+
+namespace rinhaback::benchmarks
+{
+	using namespace rinhaback::api;
+
+	static constexpr std::size_t DATABASE_SIZE = std::size_t(4) << 30;
+	static constexpr std::int64_t FIRST_PAYMENT_MILLIS = 1'752'000'000'000;
+	static constexpr std::int64_t PAYMENT_INTERVAL_MILLIS = 1;
+	static constexpr std::int64_t POPULATE_BATCH_SIZE = 10'000;
+
+	// Distinct valid UUIDs, as payments stored twice are ignored.
+	static CorrelationId makeCorrelationId(std::uint64_t index)
+	{
+		static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+		CorrelationId correlationId;
+		std::ranges::copy(std::string_view("00000000-0000-4000-8000-000000000000"), correlationId.begin());
+
+		for (auto i = correlationId.size(); i-- > correlationId.size() - 12; index >>= 4)
+			correlationId[i] = HEX_DIGITS[index & 15];
+
+		return correlationId;
+	}
+
+	// A temporary database with rows payments in the default gateway, one per millisecond.
+	struct PopulatedDatabase
+	{
+		PopulatedDatabase(const std::string& name, std::int64_t rows)
+			: connection((getTemporaryDirectory() / name).string(), DATABASE_SIZE, true),
+			  rows(rows)
+		{
+			for (std::int64_t batchStart = 0; batchStart < rows; batchStart += POPULATE_BATCH_SIZE)
+			{
+				Transaction transaction(connection, 0);
+
+				for (auto i = batchStart; i < rows && i < batchStart + POPULATE_BATCH_SIZE; ++i)
+				{
+					repository.postPayment(transaction, 19.90, makeCorrelationId(static_cast<std::uint64_t>(i)),
+						getPaymentDateTime(i));
+				}
+			}
+		}
+
+		static DateTimeMillis getPaymentDateTime(std::int64_t index)
+		{
+			return DateTimeMillis(std::chrono::milliseconds(FIRST_PAYMENT_MILLIS + index * PAYMENT_INTERVAL_MILLIS));
+		}
+
+		Connection connection;
+		PaymentRepository repository{PaymentGateway::DEFAULT};
+		const std::int64_t rows;
+	};
+
+	// Populating is slow, so each database is reused by all the runs of a benchmark.
+	static PopulatedDatabase& getDatabase(const std::string& benchmark, std::int64_t rows)
+	{
+		static std::map<std::pair<std::string, std::int64_t>, std::unique_ptr<PopulatedDatabase>> databases;
+		auto& database = databases[{benchmark, rows}];
+
+		if (!database)
+			database = std::make_unique<PopulatedDatabase>(benchmark + "-" + std::to_string(rows), rows);
+
+		return *database;
+	}
+
+	// One write transaction per payment, as with COMMIT_BATCH_SIZE=1.
+	static void BM_PaymentRepository_PostPayment(benchmark::State& state)
+	{
+		auto& database = getDatabase("post-payment", state.range(0));
+
+		// Payments are appended after the existing ones, as the server does.
+		static std::int64_t nextIndex = 0;
+		nextIndex = std::max(nextIndex, database.rows);
+
+		for (auto _ : state)
+		{
+			Transaction transaction(database.connection, 0);
+			const auto correlationId = makeCorrelationId(static_cast<std::uint64_t>(nextIndex));
+			database.repository.postPayment(
+				transaction, 19.90, correlationId, PopulatedDatabase::getPaymentDateTime(nextIndex));
+			++nextIndex;
+		}
+
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	BENCHMARK(BM_PaymentRepository_PostPayment)->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+
+	// Range of the middle half of the payments, not aligned to the summary buckets.
+	static void BM_PaymentRepository_GetPaymentsSummary(benchmark::State& state)
+	{
+		auto& database = getDatabase("summary", state.range(0));
+		const auto from = PopulatedDatabase::getPaymentDateTime(database.rows / 4 + 7).time_since_epoch().count();
+		const auto to = PopulatedDatabase::getPaymentDateTime(database.rows * 3 / 4 + 3).time_since_epoch().count();
+
+		for (auto _ : state)
+		{
+			Transaction transaction(database.connection, MDB_RDONLY);
+			benchmark::DoNotOptimize(database.repository.getPaymentsSummary(transaction, from, to));
+		}
+
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	BENCHMARK(BM_PaymentRepository_GetPaymentsSummary)->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+
+	// Whole table, as a summary without from and to.
+	static void BM_PaymentRepository_GetPaymentsSummaryUnbounded(benchmark::State& state)
+	{
+		auto& database = getDatabase("summary", state.range(0));
+
+		for (auto _ : state)
+		{
+			Transaction transaction(database.connection, MDB_RDONLY);
+			benchmark::DoNotOptimize(database.repository.getPaymentsSummary(transaction, std::nullopt, std::nullopt));
+		}
+
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	BENCHMARK(BM_PaymentRepository_GetPaymentsSummaryUnbounded)->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+}  // namespace rinhaback::benchmarks
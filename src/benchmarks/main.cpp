@@ -0,0 +1,62 @@
+#include "./Environment.h"
+#include "../api/SharedMemory.h"
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include "benchmark/benchmark.h"
+
+namespace stdfs = std::filesystem;
+
+
+namespace rinhaback::benchmarks
+{
+	// Runs before the dynamic initialization of Config, which reads the environment.
+	// This process creates shared memory (metrics) under names of its own, so a server running on the same host is
+	// left alone, and nothing touches the configured database.
+	__attribute__((constructor(101))) static void setupEnvironment()
+	{
+		setenv("DATABASE_INIT", "true", 1);
+		setenv("INSTANCE_ID", "0", 1);
+		setenv("SHARED_MEMORY_PREFIX", ("rinhaback25-benchmarks-" + std::to_string(getpid())).c_str(), 1);
+	}
+
+	const stdfs::path& getTemporaryDirectory()
+	{
+		static const stdfs::path directory = []
+		{
+			auto pattern = (stdfs::temp_directory_path() / "rinhaback25-benchmarks-XXXXXX").string();
+
+			if (!mkdtemp(pattern.data()))
+				throw std::system_error(errno, std::generic_category(), "Cannot create the temporary directory");
+
+			return stdfs::path(pattern);
+		}();
+
+		return directory;
+	}
+}  // namespace rinhaback::benchmarks
+
+int main(int argc, char* argv[])
+{
+	using namespace rinhaback::benchmarks;
+
+	benchmark::Initialize(&argc, argv);
+
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	// Databases and segments still open are unlinked, which is fine.
+	std::error_code errorCode;
+	stdfs::remove_all(getTemporaryDirectory(), errorCode);
+
+	for (const auto baseName : {"SharedData", "PendingPaymentsQueue", "PaymentMirror"})
+		rinhaback::api::SharedMemorySegment::remove(baseName);
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+
+namespace rinhaback::load
+{
+	class Config final
+	{
+	private:
+		static std::string readEnv(const char* name, const char* defaultVal)
+		{
+			const auto val = std::getenv(name);
+			return val ? val : defaultVal;
+		}
+
+		static std::vector<std::string> readList(const char* name)
+		{
+			const auto list = readEnv(name, "");
+			std::vector<std::string> items;
+			std::size_t start = 0;
+
+			while (start < list.size())
+			{
+				auto end = list.find(',', start);
+
+				if (end == std::string::npos)
+					end = list.size();
+
+				if (end > start)
+					items.push_back(list.substr(start, end - start));
+
+				start = end + 1;
+			}
+
+			return items;
+		}
+
+	public:
+		Config() = delete;
+
+	public:
+		static inline const auto url = readEnv("LOAD_URL", "http://localhost:9999");
+		static inline const auto threads = (unsigned) std::stoi(readEnv("LOAD_THREADS", "1"));
+		static inline const auto connections = (unsigned) std::stoi(readEnv("LOAD_CONNECTIONS", "256"));
+		static inline const auto timeout = std::chrono::milliseconds(std::stoi(readEnv("LOAD_TIMEOUT", "5000")));
+		static inline const auto purge = readEnv("LOAD_PURGE", "true") == "true";
+		// Generated traffic: payments and summaries per second, for the duration.
+		static inline const auto rate = std::stod(readEnv("LOAD_RATE", "1000"));
+		static inline const auto summaryRate = std::stod(readEnv("LOAD_SUMMARY_RATE", "1"));
+		static inline const auto duration = std::chrono::milliseconds(std::stoi(readEnv("LOAD_DURATION", "60000")));
+		static inline const auto amount = std::stod(readEnv("LOAD_AMOUNT", "19.90"));
+		// Replayed traffic: TrafficLog files (merged by time) replayed at speed times their original rate.
+		static inline const auto replay = readList("LOAD_REPLAY");
+		static inline const auto replaySpeed = std::stod(readEnv("LOAD_REPLAY_SPEED", "1"));
+		static inline const auto replayKeepIds = readEnv("LOAD_REPLAY_KEEP_IDS", "false") == "true";
+	};
+}  // namespace rinhaback::load
@@ -0,0 +1,47 @@
+#include "./LatencyHistogram.h"
+#include <algorithm>
+#include <cmath>
+
+
+namespace rinhaback::load
+{
+	void LatencyHistogram::record(std::chrono::microseconds latency)
+	{
+		const auto micros =
+			std::min(static_cast<std::uint64_t>(std::max<std::int64_t>(latency.count(), 0)), MAX_MICROS);
+
+		++buckets[Buckets::getBucket(micros)];
+		++count;
+		sum += micros;
+		max = std::max(max, micros);
+	}
+
+	void LatencyHistogram::merge(const LatencyHistogram& other)
+	{
+		for (unsigned i = 0; i < Buckets::COUNT; ++i)
+			buckets[i] += other.buckets[i];
+
+		count += other.count;
+		sum += other.sum;
+		max = std::max(max, other.max);
+	}
+
+	std::chrono::microseconds LatencyHistogram::getPercentile(double quantile) const
+	{
+		if (count == 0)
+			return std::chrono::microseconds(0);
+
+		const auto target = std::max<std::uint64_t>(static_cast<std::uint64_t>(std::ceil(quantile * count)), 1);
+		std::uint64_t accumulated = 0;
+
+		for (unsigned bucket = 0; bucket < Buckets::COUNT; ++bucket)
+		{
+			accumulated += buckets[bucket];
+
+			if (accumulated >= target)
+				return std::chrono::microseconds(std::min(Buckets::getUpperBound(bucket), max));
+		}
+
+		return getMax();
+	}
+}  // namespace rinhaback::load
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "../api/LogLinearBuckets.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+
+namespace rinhaback::load
+{
+	// HDR-style histogram of microseconds: 2^SUB_BITS linear sub-buckets per power of two, so every recorded
+	// value is kept with a relative error under 1%, up to MAX_MICROS.
+	class LatencyHistogram final
+	{
+	public:
+		void record(std::chrono::microseconds latency);
+		void merge(const LatencyHistogram& other);
+
+		std::uint64_t getCount() const
+		{
+			return count;
+		}
+
+		// Highest equivalent value of the quantile (0 to 1).
+		std::chrono::microseconds getPercentile(double quantile) const;
+
+		std::chrono::microseconds getMax() const
+		{
+			return std::chrono::microseconds(max);
+		}
+
+		std::chrono::microseconds getMean() const
+		{
+			return std::chrono::microseconds(count ? sum / count : 0);
+		}
+
+	private:
+		static inline constexpr unsigned SUB_BITS = 7;
+		static inline constexpr unsigned MAX_BITS = 40;
+		static inline constexpr std::uint64_t MAX_MICROS = (std::uint64_t(1) << MAX_BITS) - 1;
+
+		using Buckets = api::LogLinearBuckets<SUB_BITS, MAX_BITS>;
+
+	private:
+		std::array<std::uint64_t, Buckets::COUNT> buckets{};
+		std::uint64_t count = 0;
+		std::uint64_t sum = 0;
+		std::uint64_t max = 0;
+	};
+}  // namespace rinhaback::load
@@ -0,0 +1,234 @@
+#include "./LoadGenerator.h"
+#include "./Config.h"
+#include "../api/SignalHandling.h"
+#include "../api/Util.h"
+#include <algorithm>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+
+namespace rinhaback::load
+{
+	static constexpr int POLL_TIME = 1;
+
+	void LoadGenerator::Results::merge(const Results& other)
+	{
+		const auto mergeKind = [](Kind& kind, const Kind& otherKind)
+		{
+			kind.latency.merge(otherKind.latency);
+			kind.scheduled += otherKind.scheduled;
+			kind.successes += otherKind.successes;
+			kind.clientErrors += otherKind.clientErrors;
+			kind.serverErrors += otherKind.serverErrors;
+			kind.failures += otherKind.failures;
+		};
+
+		mergeKind(payments, other.payments);
+		mergeKind(summaries, other.summaries);
+	}
+
+	LoadGenerator::LoadGenerator(RequestSource source, unsigned maxConnections)
+		: source(std::move(source)),
+		  maxConnections(std::max(maxConnections, 1u))
+	{
+		mg_mgr_init(&mgr);
+
+		const auto urlHost = mg_url_host(Config::url.c_str());
+		host.assign(urlHost.buf, urlHost.len);
+	}
+
+	LoadGenerator::~LoadGenerator()
+	{
+		mg_mgr_free(&mgr);
+	}
+
+	void LoadGenerator::run()
+	{
+		startedAt = std::chrono::steady_clock::now();
+
+		Request next;
+		bool hasNext = source(next);
+
+		while (!SignalHandling::shouldFinish())
+		{
+			const auto now = std::chrono::steady_clock::now();
+
+			while (hasNext && startedAt + next.offset <= now)
+			{
+				++getResults(next.record.kind).scheduled;
+				backlog.push_back(std::move(next));
+				hasNext = source(next);
+			}
+
+			dispatch(now);
+			expire(now);
+
+			if (!hasNext && backlog.empty() && inFlightCount == 0)
+				break;
+
+			mg_mgr_poll(&mgr, POLL_TIME);
+		}
+	}
+
+	void LoadGenerator::eventHandler(mg_connection* conn, int ev, void* evData)
+	{
+		auto& generator = *static_cast<LoadGenerator*>(conn->fn_data);
+		const auto connectionIt = generator.connections.find(conn->id);
+
+		if (connectionIt == generator.connections.end())
+			return;
+
+		auto& connection = connectionIt->second;
+
+		switch (ev)
+		{
+			case MG_EV_CONNECT:
+				connection.connected = true;
+				--generator.pendingConnections;
+				generator.idleConnections.push_back(conn->id);
+				break;
+
+			case MG_EV_HTTP_MSG:
+				if (connection.inFlight)
+					generator.complete(connection, mg_http_status(static_cast<mg_http_message*>(evData)));
+				break;
+
+			case MG_EV_CLOSE:
+				if (!connection.connected)
+					--generator.pendingConnections;
+
+				if (connection.inFlight)
+				{
+					++generator.getResults(connection.inFlight->kind).failures;
+					--generator.inFlightCount;
+				}
+
+				generator.connections.erase(connectionIt);
+				break;
+		}
+	}
+
+	void LoadGenerator::dispatch(std::chrono::steady_clock::time_point now)
+	{
+		while (!backlog.empty() && !idleConnections.empty())
+		{
+			const auto connectionIt = connections.find(idleConnections.back());
+			idleConnections.pop_back();
+
+			// Closed meanwhile.
+			if (connectionIt == connections.end())
+				continue;
+
+			send(connectionIt->second, backlog.front(), now);
+			backlog.pop_front();
+		}
+
+		// Opens connections for the requests still waiting.
+		while (pendingConnections < backlog.size() && connections.size() < maxConnections)
+		{
+			const auto conn = mg_http_connect(&mgr, Config::url.c_str(), eventHandler, this);
+
+			if (!conn)
+				break;
+
+			connections.emplace(conn->id, Connection{.conn = conn});
+			++pendingConnections;
+		}
+	}
+
+	void LoadGenerator::send(Connection& connection, const Request& request, std::chrono::steady_clock::time_point now)
+	{
+		const auto& record = request.record;
+
+		if (record.kind == api::TrafficLog::Kind::PAYMENT)
+		{
+			char body[128];
+			const auto formatResult = std::format_to_n(body, sizeof(body),
+				R"({{"correlationId":"{}","amount":{:.2f}}})",
+				std::string_view(record.correlationId.data(), record.correlationId.size()), record.amount);
+			const auto length = static_cast<int>(formatResult.size);
+
+			mg_printf(connection.conn,
+				"POST /payments HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n"
+				"%.*s",
+				host.c_str(), length, length, body);
+		}
+		else
+		{
+			std::string query;
+
+			const auto appendDateTime = [&](const char* name, std::optional<std::int64_t> value)
+			{
+				if (value)
+				{
+					char dateTime[32];
+					const auto dateTimeEnd =
+						api::formatDateTime(api::DateTimeMillis(std::chrono::milliseconds(*value)), dateTime);
+
+					query += query.empty() ? '?' : '&';
+					query += name;
+					query += '=';
+					query.append(dateTime, dateTimeEnd);
+				}
+			};
+
+			appendDateTime("from", record.from);
+			appendDateTime("to", record.to);
+
+			mg_printf(connection.conn, "GET /payments-summary%s HTTP/1.1\r\nHost: %s\r\n\r\n", query.c_str(),
+				host.c_str());
+		}
+
+		connection.inFlight = InFlight{
+			.scheduledAt = startedAt + request.offset,
+			.sentAt = now,
+			.kind = record.kind,
+		};
+
+		++inFlightCount;
+	}
+
+	void LoadGenerator::complete(Connection& connection, int httpStatus)
+	{
+		auto& kindResults = getResults(connection.inFlight->kind);
+
+		kindResults.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - connection.inFlight->scheduledAt));
+
+		if (httpStatus >= 200 && httpStatus <= 299)
+			++kindResults.successes;
+		else if (httpStatus >= 400 && httpStatus <= 499)
+			++kindResults.clientErrors;
+		else if (httpStatus >= 500 && httpStatus <= 599)
+			++kindResults.serverErrors;
+		else
+			++kindResults.failures;
+
+		connection.inFlight.reset();
+		--inFlightCount;
+		idleConnections.push_back(connection.conn->id);
+	}
+
+	void LoadGenerator::expire(std::chrono::steady_clock::time_point now)
+	{
+		for (auto& [id, connection] : connections)
+		{
+			if (connection.inFlight && now - connection.inFlight->sentAt > Config::timeout)
+			{
+				++getResults(connection.inFlight->kind).failures;
+				connection.inFlight.reset();
+				--inFlightCount;
+				connection.conn->is_closing = 1;
+			}
+		}
+
+		while (!backlog.empty() && now - (startedAt + backlog.front().offset) > Config::timeout)
+		{
+			++getResults(backlog.front().record.kind).failures;
+			backlog.pop_front();
+		}
+	}
+}  // namespace rinhaback::load
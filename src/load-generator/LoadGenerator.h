@@ -0,0 +1,108 @@
+#pragma once
+
+#include "./LatencyHistogram.h"
+#include "../api/TrafficLog.h"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include "mongoose.h"
+
+
+namespace rinhaback::load
+{
+	// Open-loop HTTP load of one thread: requests are sent at their scheduled times over up to maxConnections
+	// keep-alive connections, whatever the responses take. Latencies count from the scheduled time, so the time
+	// waiting for a free connection isn't omitted (coordinated omission).
+	class LoadGenerator final
+	{
+	public:
+		struct Request
+		{
+			std::chrono::nanoseconds offset;  // from the start of the run
+			api::TrafficLog::Record record;
+		};
+
+		// Returns false when there are no more requests. Requests must come in offset order.
+		using RequestSource = std::function<bool(Request&)>;
+
+		struct Results
+		{
+			struct Kind
+			{
+				LatencyHistogram latency;
+				std::uint64_t scheduled = 0;
+				std::uint64_t successes = 0;
+				std::uint64_t clientErrors = 0;
+				std::uint64_t serverErrors = 0;
+				std::uint64_t failures = 0;  // connection errors and timeouts
+			};
+
+			Kind payments;
+			Kind summaries;
+
+			void merge(const Results& other);
+		};
+
+	private:
+		struct InFlight
+		{
+			std::chrono::steady_clock::time_point scheduledAt;
+			std::chrono::steady_clock::time_point sentAt;
+			api::TrafficLog::Kind kind;
+		};
+
+		struct Connection
+		{
+			mg_connection* conn;
+			bool connected = false;
+			std::optional<InFlight> inFlight;
+		};
+
+	public:
+		LoadGenerator(RequestSource source, unsigned maxConnections);
+		~LoadGenerator();
+
+		LoadGenerator(const LoadGenerator&) = delete;
+		LoadGenerator& operator=(const LoadGenerator&) = delete;
+
+	public:
+		// Runs until all the requests got responses or failed.
+		void run();
+
+		const Results& getResults() const
+		{
+			return results;
+		}
+
+	private:
+		static void eventHandler(mg_connection* conn, int ev, void* evData);
+
+		void dispatch(std::chrono::steady_clock::time_point now);
+		void send(Connection& connection, const Request& request, std::chrono::steady_clock::time_point now);
+		void complete(Connection& connection, int httpStatus);
+		void expire(std::chrono::steady_clock::time_point now);
+
+		Results::Kind& getResults(api::TrafficLog::Kind kind)
+		{
+			return kind == api::TrafficLog::Kind::PAYMENT ? results.payments : results.summaries;
+		}
+
+	private:
+		RequestSource source;
+		unsigned maxConnections;
+		mg_mgr mgr;
+		std::string host;
+		std::chrono::steady_clock::time_point startedAt;
+		std::deque<Request> backlog;
+		std::unordered_map<unsigned long, Connection> connections;
+		std::vector<unsigned long> idleConnections;
+		unsigned pendingConnections = 0;
+		unsigned inFlightCount = 0;
+		Results results;
+	};
+}  // namespace rinhaback::load
@@ -0,0 +1,247 @@
+#include "./Config.h"
+#include "./LoadGenerator.h"
+#include "../api/SignalHandling.h"
+#include "../api/TrafficLog.h"
+#include "../api/Util.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <print>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include "httplib.h"
+
+
+// Open-loop load of POST /payments and GET /payments-summary, either generated at LOAD_RATE / LOAD_SUMMARY_RATE for
+// LOAD_DURATION, or replayed from the TrafficLog files (TRAFFIC_RECORD of the API) of LOAD_REPLAY at
+// LOAD_REPLAY_SPEED. Reports the status counts and the latency percentiles of each kind of request.
+namespace rinhaback::load
+{
+	using api::CorrelationId;
+	using api::SignalHandling;
+	using api::TrafficLog;
+
+	static std::chrono::nanoseconds toNanos(double seconds)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(seconds));
+	}
+
+	// Random (version 4) UUID.
+	static CorrelationId generateCorrelationId(std::mt19937_64& random)
+	{
+		static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+		CorrelationId correlationId;
+		std::uint64_t bits = 0;
+		unsigned remainingDigits = 0;
+
+		for (unsigned i = 0; i < correlationId.size(); ++i)
+		{
+			if (i == 8 || i == 13 || i == 18 || i == 23)
+				correlationId[i] = '-';
+			else if (i == 14)
+				correlationId[i] = '4';
+			else
+			{
+				if (remainingDigits == 0)
+				{
+					bits = random();
+					remainingDigits = 16;
+				}
+
+				// The variant digit is 8, 9, a or b.
+				correlationId[i] = HEX_DIGITS[i == 19 ? 8 | (bits & 3) : bits & 15];
+				bits >>= 4;
+				--remainingDigits;
+			}
+		}
+
+		return correlationId;
+	}
+
+	// Payments evenly spaced, interleaved between the threads. Summaries (first thread only) cover the run so far.
+	static LoadGenerator::RequestSource makeGeneratedSource(
+		unsigned thread, unsigned threadCount, api::DateTimeMillis startedAt)
+	{
+		const auto paymentInterval = Config::rate > 0 ? 1 / Config::rate : 0;
+		const auto summaryInterval = Config::summaryRate > 0 && thread == 0 ? 1 / Config::summaryRate : 0;
+
+		return [=, random = std::mt19937_64(std::random_device{}()), paymentIndex = std::uint64_t(0),
+				   summaryIndex = std::uint64_t(1)](LoadGenerator::Request& request) mutable
+		{
+			const auto paymentOffset = paymentInterval > 0
+				? toNanos(static_cast<double>(paymentIndex * threadCount + thread) * paymentInterval)
+				: std::chrono::nanoseconds::max();
+			const auto summaryOffset = summaryInterval > 0
+				? toNanos(static_cast<double>(summaryIndex) * summaryInterval)
+				: std::chrono::nanoseconds::max();
+
+			request.offset = std::min(paymentOffset, summaryOffset);
+
+			if (request.offset >= Config::duration)
+				return false;
+
+			if (paymentOffset <= summaryOffset)
+			{
+				request.record = TrafficLog::Record{
+					.kind = TrafficLog::Kind::PAYMENT,
+					.amount = Config::amount,
+					.correlationId = generateCorrelationId(random),
+				};
+
+				++paymentIndex;
+			}
+			else
+			{
+				const auto to = startedAt + std::chrono::duration_cast<std::chrono::milliseconds>(summaryOffset);
+
+				request.record = TrafficLog::Record{
+					.kind = TrafficLog::Kind::SUMMARY,
+					.from = startedAt.time_since_epoch().count(),
+					.to = to.time_since_epoch().count(),
+				};
+
+				++summaryIndex;
+			}
+
+			return true;
+		};
+	}
+
+	// Every threadCount-th record starting at thread, with times scaled by LOAD_REPLAY_SPEED. Summary ranges are moved
+	// to the same place in the replay.
+	static LoadGenerator::RequestSource makeReplaySource(
+		std::shared_ptr<const std::vector<TrafficLog::Record>> records, unsigned thread, unsigned threadCount,
+		api::DateTimeMillis startedAt)
+	{
+		const auto firstMicros = records->front().timeMicros;
+		const auto startedAtMillis = startedAt.time_since_epoch().count();
+
+		const auto toReplayMillis = [=](std::int64_t millis)
+		{ return startedAtMillis + static_cast<std::int64_t>((millis - firstMicros / 1000) / Config::replaySpeed); };
+
+		return [=, random = std::mt19937_64(std::random_device{}()), index = std::size_t(thread)](
+				   LoadGenerator::Request& request) mutable
+		{
+			if (index >= records->size())
+				return false;
+
+			request.record = (*records)[index];
+			request.offset = toNanos(
+				static_cast<double>(request.record.timeMicros - firstMicros) / 1'000'000 / Config::replaySpeed);
+
+			if (request.record.kind == TrafficLog::Kind::PAYMENT && !Config::replayKeepIds)
+				request.record.correlationId = generateCorrelationId(random);
+
+			if (request.record.from)
+				request.record.from = toReplayMillis(*request.record.from);
+
+			if (request.record.to)
+				request.record.to = toReplayMillis(*request.record.to);
+
+			index += threadCount;
+
+			return true;
+		};
+	}
+
+	static std::shared_ptr<const std::vector<TrafficLog::Record>> readReplay()
+	{
+		auto records = std::make_shared<std::vector<TrafficLog::Record>>();
+
+		for (const auto& path : Config::replay)
+		{
+			const auto fileRecords = TrafficLog::read(path);
+			records->insert(records->end(), fileRecords.begin(), fileRecords.end());
+		}
+
+		// Files of different instances are merged by time.
+		std::ranges::stable_sort(*records, {}, &TrafficLog::Record::timeMicros);
+
+		if (records->empty())
+			throw std::runtime_error("No records to replay");
+
+		return records;
+	}
+
+	static void printResults(const char* name, const LoadGenerator::Results::Kind& results)
+	{
+		const auto& latency = results.latency;
+
+		std::println("{}: {} scheduled, {} 2xx, {} 4xx, {} 5xx, {} failed", name, results.scheduled, results.successes,
+			results.clientErrors, results.serverErrors, results.failures);
+		std::println("  latency (us): mean {}, p50 {}, p90 {}, p99 {}, p99.9 {}, max {}", latency.getMean().count(),
+			latency.getPercentile(0.5).count(), latency.getPercentile(0.9).count(),
+			latency.getPercentile(0.99).count(), latency.getPercentile(0.999).count(), latency.getMax().count());
+	}
+
+	static int run()
+	{
+		SignalHandling::install();
+
+		const auto records = Config::replay.empty() ? nullptr : readReplay();
+
+		if (Config::purge)
+		{
+			httplib::Client client(Config::url);
+
+			if (const auto response = client.Post("/purge-payments"); !response || response->status != 200)
+				throw std::runtime_error("Cannot purge the payments on " + Config::url);
+		}
+
+		const auto startedAt = api::getCurrentDateTime();
+		const auto steadyStartedAt = std::chrono::steady_clock::now();
+		const auto threadCount = std::max(Config::threads, 1u);
+		const auto connectionsPerThread = std::max(Config::connections / threadCount, 1u);
+
+		std::vector<std::unique_ptr<LoadGenerator>> generators;
+		std::vector<std::jthread> threads;
+
+		for (unsigned thread = 0; thread < threadCount; ++thread)
+		{
+			generators.push_back(std::make_unique<LoadGenerator>(
+				records ? makeReplaySource(records, thread, threadCount, startedAt)
+						: makeGeneratedSource(thread, threadCount, startedAt),
+				connectionsPerThread));
+		}
+
+		for (auto& generator : generators)
+			threads.emplace_back([&generator] { generator->run(); });
+
+		threads.clear();
+
+		const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - steadyStartedAt);
+		LoadGenerator::Results results;
+
+		for (const auto& generator : generators)
+			results.merge(generator->getResults());
+
+		std::println("Elapsed: {:.2f}s, {:.1f} requests/s", elapsed.count(),
+			static_cast<double>(results.payments.latency.getCount() + results.summaries.latency.getCount()) /
+				elapsed.count());
+
+		printResults("payments", results.payments);
+		printResults("summaries", results.summaries);
+
+		return 0;
+	}
+}  // namespace rinhaback::load
+
+int main()
+{
+	using namespace rinhaback::load;
+
+	try
+	{
+		return run();
+	}
+	catch (const std::exception& e)
+	{
+		std::println(stderr, "{}", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <cstdlib>
+
+
+namespace rinhaback::mock
+{
+	class Config final
+	{
+	private:
+		static std::string readEnv(const char* name, const char* defaultVal)
+		{
+			const auto val = std::getenv(name);
+			return val ? val : defaultVal;
+		}
+
+	public:
+		Config() = delete;
+
+	public:
+		static inline const auto listenAddress = readEnv("MOCK_LISTEN_ADDRESS", "0.0.0.0:8080");
+		static inline const auto pollTime = (unsigned) std::stoi(readEnv("MOCK_POLL_TIME", "1"));
+		static inline const auto healthInterval =
+			std::chrono::milliseconds(std::stoi(readEnv("MOCK_HEALTH_INTERVAL", "5000")));
+		static inline const auto fee = std::stod(readEnv("MOCK_FEE", "0.05"));
+		// Optional JSON file with the initial profile (see Profile).
+		static inline const auto profile = readEnv("MOCK_PROFILE", "");
+	};
+}  // namespace rinhaback::mock
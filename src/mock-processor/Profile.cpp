@@ -0,0 +1,194 @@
+#include "./Profile.h"
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <utility>
+#include <experimental/scope>
+#include "yyjson.h"
+
+
+namespace rinhaback::mock
+{
+	Profile::Profile(std::vector<Phase> phases, bool loop)
+		: phases(std::move(phases)),
+		  loop(loop)
+	{
+		if (this->phases.empty())
+			this->phases.emplace_back();
+
+		for (const auto& phase : this->phases)
+			totalDuration += phase.duration;
+	}
+
+	std::optional<Profile> Profile::parse(std::string_view json, std::string& error)
+	{
+		const auto docJson = yyjson_read(json.data(), json.size(), 0);
+
+		if (!docJson)
+		{
+			error = "Invalid JSON";
+			return std::nullopt;
+		}
+
+		std::experimental::scope_exit scopeExit([&]() { yyjson_doc_free(docJson); });
+
+		const auto rootJson = yyjson_doc_get_root(docJson);
+		const auto phasesJson = yyjson_obj_get(rootJson, "phases");
+
+		if (!yyjson_is_arr(phasesJson) || yyjson_arr_size(phasesJson) == 0)
+		{
+			error = "\"phases\" must be a non-empty array";
+			return std::nullopt;
+		}
+
+		const auto getNumber = [](yyjson_val* objectJson, const char* key, double defaultValue)
+		{
+			const auto valueJson = yyjson_obj_get(objectJson, key);
+			return yyjson_is_num(valueJson) ? yyjson_get_num(valueJson) : defaultValue;
+		};
+
+		std::vector<Phase> phases;
+		std::size_t index, max;
+		yyjson_val* phaseJson;
+
+		yyjson_arr_foreach(phasesJson, index, max, phaseJson)
+		{
+			Phase phase;
+			phase.duration = std::chrono::milliseconds(static_cast<std::int64_t>(getNumber(phaseJson, "duration", 0)));
+			phase.failing = yyjson_get_bool(yyjson_obj_get(phaseJson, "failing"));
+			phase.serverErrorRatio = getNumber(phaseJson, "serverErrorRatio", 0);
+			phase.clientErrorRatio = getNumber(phaseJson, "clientErrorRatio", 0);
+			phase.serverErrorStatus = static_cast<int>(getNumber(phaseJson, "serverErrorStatus", 500));
+			phase.clientErrorStatus = static_cast<int>(getNumber(phaseJson, "clientErrorStatus", 422));
+
+			if (phase.duration.count() < 0 || phase.serverErrorRatio < 0 || phase.clientErrorRatio < 0 ||
+				phase.serverErrorRatio + phase.clientErrorRatio > 1)
+			{
+				error = std::format("Invalid duration or error ratios in phase {}", index);
+				return std::nullopt;
+			}
+
+			if (const auto latencyJson = yyjson_obj_get(phaseJson, "latency"))
+			{
+				const auto distributionStr = yyjson_get_str(yyjson_obj_get(latencyJson, "distribution"));
+				const std::string_view distribution = distributionStr ? distributionStr : "fixed";
+
+				if (distribution == "fixed")
+					phase.latency.distribution = Distribution::FIXED;
+				else if (distribution == "uniform")
+					phase.latency.distribution = Distribution::UNIFORM;
+				else if (distribution == "normal")
+					phase.latency.distribution = Distribution::NORMAL;
+				else if (distribution == "lognormal")
+					phase.latency.distribution = Distribution::LOG_NORMAL;
+				else
+				{
+					error = std::format("Invalid latency distribution in phase {}", index);
+					return std::nullopt;
+				}
+
+				phase.latency.mean = getNumber(latencyJson, "mean", 0);
+				phase.latency.stddev = getNumber(latencyJson, "stddev", 0);
+				phase.latency.min = getNumber(latencyJson, "min", 0);
+				phase.latency.max = getNumber(latencyJson, "max", 0);
+
+				if ((phase.latency.distribution == Distribution::UNIFORM && phase.latency.max < phase.latency.min) ||
+					((phase.latency.distribution == Distribution::NORMAL ||
+						 phase.latency.distribution == Distribution::LOG_NORMAL) &&
+						phase.latency.stddev <= 0))
+				{
+					error = std::format("Invalid latency parameters in phase {}", index);
+					return std::nullopt;
+				}
+			}
+
+			phases.push_back(phase);
+		}
+
+		return Profile(std::move(phases), yyjson_get_bool(yyjson_obj_get(rootJson, "loop")));
+	}
+
+	Profile::Outcome Profile::sample(std::chrono::steady_clock::time_point now, std::mt19937_64& random) const
+	{
+		const auto& phase = getPhase(now);
+		const auto& latency = phase.latency;
+		double millis;
+
+		switch (latency.distribution)
+		{
+			case Distribution::UNIFORM:
+				millis = std::uniform_real_distribution<double>(latency.min, latency.max)(random);
+				break;
+
+			case Distribution::NORMAL:
+				millis = std::normal_distribution<double>(latency.mean, latency.stddev)(random);
+				break;
+
+			case Distribution::LOG_NORMAL:
+			{
+				const auto median = std::max(latency.mean, 0.001);
+				millis = std::lognormal_distribution<double>(std::log(median), latency.stddev)(random);
+				break;
+			}
+
+			default:
+				millis = latency.mean;
+				break;
+		}
+
+		millis = std::max(millis, latency.min);
+
+		if (latency.max > 0)
+			millis = std::min(millis, latency.max);
+
+		const auto draw = std::uniform_real_distribution<double>(0, 1)(random);
+		int httpStatus = 200;
+
+		if (phase.failing || draw < phase.serverErrorRatio)
+			httpStatus = phase.serverErrorStatus;
+		else if (draw < phase.serverErrorRatio + phase.clientErrorRatio)
+			httpStatus = phase.clientErrorStatus;
+
+		return Outcome{
+			.latency = std::chrono::microseconds(static_cast<std::int64_t>(std::max(millis, 0.0) * 1000)),
+			.httpStatus = httpStatus,
+		};
+	}
+
+	std::int64_t Profile::getMinResponseTime(std::chrono::steady_clock::time_point now) const
+	{
+		const auto& latency = getPhase(now).latency;
+
+		return static_cast<std::int64_t>(latency.distribution == Distribution::FIXED ? latency.mean : latency.min);
+	}
+
+	void Profile::setDelay(std::chrono::milliseconds delay)
+	{
+		for (auto& phase : phases)
+			phase.latency = Latency{.mean = static_cast<double>(delay.count())};
+	}
+
+	void Profile::setFailing(bool failing)
+	{
+		for (auto& phase : phases)
+			phase.failing = failing;
+	}
+
+	const Profile::Phase& Profile::getPhase(std::chrono::steady_clock::time_point now) const
+	{
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startedAt);
+
+		if (loop && totalDuration.count() > 0)
+			elapsed %= totalDuration.count();
+
+		for (const auto& phase : phases)
+		{
+			if (elapsed < phase.duration)
+				return phase;
+
+			elapsed -= phase.duration;
+		}
+
+		return phases.back();
+	}
+}  // namespace rinhaback::mock
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+
+namespace rinhaback::mock
+{
+	// Scripted behavior of the mock processor: a sequence of phases, each one with its latency distribution,
+	// error ratios and health, played from the moment the profile is installed. For example:
+	//
+	// {
+	//   "loop": true,
+	//   "phases": [
+	//     {"duration": 10000, "latency": {"distribution": "uniform", "min": 1, "max": 5}},
+	//     {"duration": 5000, "latency": {"distribution": "lognormal", "mean": 200, "stddev": 0.5, "max": 2000},
+	//      "serverErrorRatio": 0.3},
+	//     {"duration": 3000, "failing": true}
+	//   ]
+	// }
+	//
+	// Times are milliseconds. Distributions are "fixed" (mean), "uniform" (min to max), "normal" (mean, stddev) and
+	// "lognormal" (mean is the median and stddev the sigma of the logarithm). Samples are clamped to min and max
+	// (when greater than zero). A failing phase answers 500 to all payments and is reported by the health check.
+	// Without loop, the last phase lasts forever.
+	class Profile final
+	{
+	public:
+		enum class Distribution : std::uint8_t
+		{
+			FIXED,
+			UNIFORM,
+			NORMAL,
+			LOG_NORMAL
+		};
+
+		struct Latency
+		{
+			Distribution distribution = Distribution::FIXED;
+			double mean = 0;
+			double stddev = 0;
+			double min = 0;
+			double max = 0;
+		};
+
+		struct Phase
+		{
+			std::chrono::milliseconds duration{0};
+			Latency latency;
+			bool failing = false;
+			double serverErrorRatio = 0;
+			double clientErrorRatio = 0;
+			int serverErrorStatus = 500;
+			int clientErrorStatus = 422;
+		};
+
+		struct Outcome
+		{
+			std::chrono::microseconds latency;
+			int httpStatus;
+		};
+
+	public:
+		// A single phase without latency nor errors.
+		Profile()
+			: Profile({Phase{}}, false)
+		{
+		}
+
+		explicit Profile(std::vector<Phase> phases, bool loop);
+
+	public:
+		// Returns std::nullopt for an invalid profile, describing the problem in error.
+		static std::optional<Profile> parse(std::string_view json, std::string& error);
+
+	public:
+		// Latency and status of a payment received at now.
+		Outcome sample(std::chrono::steady_clock::time_point now, std::mt19937_64& random) const;
+
+		bool isFailing(std::chrono::steady_clock::time_point now) const
+		{
+			return getPhase(now).failing;
+		}
+
+		// Minimum latency of the current phase, in milliseconds, as reported by the health check.
+		std::int64_t getMinResponseTime(std::chrono::steady_clock::time_point now) const;
+
+		// Equivalents of the admin configurations of the official processor, applied to all the phases.
+		void setDelay(std::chrono::milliseconds delay);
+		void setFailing(bool failing);
+
+	private:
+		const Phase& getPhase(std::chrono::steady_clock::time_point now) const;
+
+	private:
+		std::vector<Phase> phases;
+		bool loop;
+		std::chrono::milliseconds totalDuration{0};
+		std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+	};
+}  // namespace rinhaback::mock
@@ -0,0 +1,335 @@
+#include "./Config.h"
+#include "./Profile.h"
+#include "../api/SignalHandling.h"
+#include "../api/Util.h"
+#include <chrono>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <print>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <experimental/scope>
+#include "mongoose.h"
+#include "yyjson.h"
+
+
+// Stand-in of the rinha payment processor, to run the API without the official containers.
+// Besides its endpoints (POST /payments, GET /payments/service-health, GET /admin/payments-summary,
+// POST /admin/purge-payments, PUT /admin/configurations/delay and PUT /admin/configurations/failure), it accepts a
+// scripted Profile in POST /admin/profile (or in the MOCK_PROFILE file) to reproduce latency and failure patterns.
+namespace rinhaback::mock
+{
+	using api::SignalHandling;
+
+	static constexpr auto RESPONSE_HEADERS = "Content-Type: application/json\r\n";
+	static constexpr int HTTP_STATUS_BAD_REQUEST = 400;
+	static constexpr int HTTP_STATUS_NOT_FOUND = 404;
+	static constexpr int HTTP_STATUS_TOO_MANY_REQUESTS = 429;
+
+	static const auto MG_GET = mg_str("GET");
+	static const auto MG_POST = mg_str("POST");
+	static const auto MG_PUT = mg_str("PUT");
+	static const auto MG_PAYMENTS_PATH = mg_str("/payments");
+	static const auto MG_SERVICE_HEALTH_PATH = mg_str("/payments/service-health");
+	static const auto MG_ADMIN_PAYMENTS_SUMMARY_PATH = mg_str("/admin/payments-summary");
+	static const auto MG_ADMIN_PURGE_PAYMENTS_PATH = mg_str("/admin/purge-payments");
+	static const auto MG_ADMIN_PROFILE_PATH = mg_str("/admin/profile");
+	static const auto MG_ADMIN_DELAY_PATH = mg_str("/admin/configurations/delay");
+	static const auto MG_ADMIN_FAILURE_PATH = mg_str("/admin/configurations/failure");
+
+	struct Payment
+	{
+		std::int64_t requestedAt;
+		double amount;
+	};
+
+	// Reply held back for the latency sampled from the profile.
+	struct PendingReply
+	{
+		std::chrono::steady_clock::time_point dueAt;
+		unsigned long connId;
+		int httpStatus;
+
+		bool operator>(const PendingReply& other) const
+		{
+			return dueAt > other.dueAt;
+		}
+	};
+
+	// All the state belongs to the single mongoose thread.
+	static Profile profile;
+	static std::mt19937_64 random{std::random_device{}()};
+	static std::vector<Payment> payments;
+	static std::unordered_set<std::string> correlationIds;
+	static std::priority_queue<PendingReply, std::vector<PendingReply>, std::greater<>> pendingReplies;
+	static std::optional<std::chrono::steady_clock::time_point> lastHealthCheckAt;
+
+	static void replyPayment(mg_connection* conn, int httpStatus)
+	{
+		if (httpStatus == api::HTTP_STATUS_OK)
+		{
+			mg_http_reply(conn, httpStatus, RESPONSE_HEADERS, "{%m:%m}\n", MG_ESC("message"),
+				MG_ESC("payment processed successfully"));
+		}
+		else
+			mg_http_reply(conn, httpStatus, RESPONSE_HEADERS, "{%m:%m}\n", MG_ESC("message"), MG_ESC("payment failed"));
+	}
+
+	static void postPayment(mg_connection* conn, const mg_http_message* httpMessage)
+	{
+		const auto docJson = yyjson_read(httpMessage->body.buf, httpMessage->body.len, 0);
+		std::experimental::scope_exit scopeExit([&]() { yyjson_doc_free(docJson); });
+
+		const auto rootJson = yyjson_doc_get_root(docJson);
+		const auto correlationIdJson = yyjson_obj_get(rootJson, "correlationId");
+		const auto amountJson = yyjson_obj_get(rootJson, "amount");
+		const auto requestedAtJson = yyjson_obj_get(rootJson, "requestedAt");
+		const auto requestedAt =
+			yyjson_is_str(requestedAtJson) ? api::tryParseDateTime(yyjson_get_str(requestedAtJson)) : std::nullopt;
+
+		if (!yyjson_is_str(correlationIdJson) || !yyjson_is_num(amountJson) || !requestedAt.has_value())
+		{
+			replyPayment(conn, api::HTTP_STATUS_UNPROCESSABLE_CONTENT);
+			return;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		auto outcome = profile.sample(now, random);
+
+		if (outcome.httpStatus == api::HTTP_STATUS_OK)
+		{
+			if (correlationIds.emplace(yyjson_get_str(correlationIdJson)).second)
+			{
+				payments.push_back(Payment{
+					.requestedAt = requestedAt->time_since_epoch().count(),
+					.amount = yyjson_get_num(amountJson),
+				});
+			}
+			else
+				outcome.httpStatus = api::HTTP_STATUS_UNPROCESSABLE_CONTENT;
+		}
+
+		if (outcome.latency.count() == 0)
+			replyPayment(conn, outcome.httpStatus);
+		else
+		{
+			pendingReplies.push(PendingReply{
+				.dueAt = now + outcome.latency,
+				.connId = conn->id,
+				.httpStatus = outcome.httpStatus,
+			});
+		}
+	}
+
+	static void getServiceHealth(mg_connection* conn)
+	{
+		const auto now = std::chrono::steady_clock::now();
+
+		if (lastHealthCheckAt.has_value() && now - lastHealthCheckAt.value() < Config::healthInterval)
+		{
+			mg_http_reply(conn, HTTP_STATUS_TOO_MANY_REQUESTS, RESPONSE_HEADERS, "");
+			return;
+		}
+
+		lastHealthCheckAt = now;
+
+		mg_http_reply(conn, api::HTTP_STATUS_OK, RESPONSE_HEADERS, "{%m:%s,%m:%lld}\n", MG_ESC("failing"),
+			profile.isFailing(now) ? "true" : "false", MG_ESC("minResponseTime"),
+			static_cast<long long>(profile.getMinResponseTime(now)));
+	}
+
+	static void getPaymentsSummary(mg_connection* conn, const mg_http_message* httpMessage)
+	{
+		std::optional<api::DateTimeMillis> from, to;
+		char queryParamBuffer[100];
+
+		if (mg_http_get_var(&httpMessage->query, "from", queryParamBuffer, sizeof(queryParamBuffer)) > 0)
+			from = api::parseDateTime(queryParamBuffer);
+
+		if (mg_http_get_var(&httpMessage->query, "to", queryParamBuffer, sizeof(queryParamBuffer)) > 0)
+			to = api::parseDateTime(queryParamBuffer);
+
+		std::uint64_t totalRequests = 0;
+		double totalAmount = 0;
+
+		for (const auto& payment : payments)
+		{
+			if ((!from || payment.requestedAt >= from->time_since_epoch().count()) &&
+				(!to || payment.requestedAt <= to->time_since_epoch().count()))
+			{
+				++totalRequests;
+				totalAmount += payment.amount;
+			}
+		}
+
+		const auto body = std::format(
+			R"({{"totalRequests":{},"totalAmount":{:.2f},"totalFee":{:.2f},"feePerTransaction":{}}})", totalRequests,
+			totalAmount, totalAmount * Config::fee, Config::fee);
+
+		mg_http_reply(conn, api::HTTP_STATUS_OK, RESPONSE_HEADERS, "%s\n", body.c_str());
+	}
+
+	static void postProfile(mg_connection* conn, const mg_http_message* httpMessage)
+	{
+		std::string error;
+
+		if (auto newProfile = Profile::parse(std::string_view(httpMessage->body.buf, httpMessage->body.len), error))
+		{
+			profile = std::move(newProfile.value());
+			mg_http_reply(conn, api::HTTP_STATUS_OK, RESPONSE_HEADERS, "");
+		}
+		else
+		{
+			mg_http_reply(
+				conn, HTTP_STATUS_BAD_REQUEST, RESPONSE_HEADERS, "{%m:%m}\n", MG_ESC("error"), MG_ESC(error.c_str()));
+		}
+	}
+
+	static void httpHandler(mg_connection* conn, int ev, void* evData)
+	{
+		if (ev != MG_EV_HTTP_MSG)
+			return;
+
+		try
+		{
+			const auto httpMessage = static_cast<mg_http_message*>(evData);
+			const bool isGet = mg_strcmp(httpMessage->method, MG_GET) == 0;
+			const bool isPost = !isGet && mg_strcmp(httpMessage->method, MG_POST) == 0;
+			const bool isPut = !isGet && !isPost && mg_strcmp(httpMessage->method, MG_PUT) == 0;
+
+			if (isPost && mg_match(httpMessage->uri, MG_PAYMENTS_PATH, nullptr))
+				postPayment(conn, httpMessage);
+			else if (isGet && mg_match(httpMessage->uri, MG_SERVICE_HEALTH_PATH, nullptr))
+				getServiceHealth(conn);
+			else if (isGet && mg_match(httpMessage->uri, MG_ADMIN_PAYMENTS_SUMMARY_PATH, nullptr))
+				getPaymentsSummary(conn, httpMessage);
+			else if (isPost && mg_match(httpMessage->uri, MG_ADMIN_PURGE_PAYMENTS_PATH, nullptr))
+			{
+				payments.clear();
+				correlationIds.clear();
+				mg_http_reply(conn, api::HTTP_STATUS_OK, RESPONSE_HEADERS, "");
+			}
+			else if (isPost && mg_match(httpMessage->uri, MG_ADMIN_PROFILE_PATH, nullptr))
+				postProfile(conn, httpMessage);
+			else if (isPut && mg_match(httpMessage->uri, MG_ADMIN_DELAY_PATH, nullptr))
+			{
+				double delay = 0;
+
+				if (!mg_json_get_num(httpMessage->body, "$.delay", &delay) || delay < 0)
+					throw std::invalid_argument("Invalid delay");
+
+				profile.setDelay(std::chrono::milliseconds(static_cast<std::int64_t>(delay)));
+				mg_http_reply(conn, api::HTTP_STATUS_OK, RESPONSE_HEADERS, "");
+			}
+			else if (isPut && mg_match(httpMessage->uri, MG_ADMIN_FAILURE_PATH, nullptr))
+			{
+				bool failure = false;
+
+				if (!mg_json_get_bool(httpMessage->body, "$.failure", &failure))
+					throw std::invalid_argument("Invalid failure");
+
+				profile.setFailing(failure);
+				mg_http_reply(conn, api::HTTP_STATUS_OK, RESPONSE_HEADERS, "");
+			}
+			else
+			{
+				mg_http_reply(conn, HTTP_STATUS_NOT_FOUND, RESPONSE_HEADERS, "{%m:%m}\n", MG_ESC("error"),
+					MG_ESC("Unsupported URI"));
+			}
+		}
+		catch (const std::exception& e)
+		{
+			mg_http_reply(
+				conn, HTTP_STATUS_BAD_REQUEST, RESPONSE_HEADERS, "{%m:%m}\n", MG_ESC("error"), MG_ESC(e.what()));
+		}
+	}
+
+	// Sends the replies whose latency elapsed, unless their connections were closed meanwhile.
+	static void sendDueReplies(mg_mgr& mgr)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		std::unordered_multimap<unsigned long, int> dueReplies;
+
+		while (!pendingReplies.empty() && pendingReplies.top().dueAt <= now)
+		{
+			dueReplies.emplace(pendingReplies.top().connId, pendingReplies.top().httpStatus);
+			pendingReplies.pop();
+		}
+
+		for (auto conn = mgr.conns; conn && !dueReplies.empty(); conn = conn->next)
+		{
+			const auto [begin, end] = dueReplies.equal_range(conn->id);
+
+			for (auto reply = begin; reply != end; ++reply)
+				replyPayment(conn, reply->second);
+
+			dueReplies.erase(begin, end);
+		}
+	}
+
+	static int run()
+	{
+		SignalHandling::install();
+
+		if (!Config::profile.empty())
+		{
+			std::ifstream file(Config::profile);
+			std::stringstream json;
+			json << file.rdbuf();
+
+			std::string error;
+
+			if (auto initialProfile = Profile::parse(json.str(), error))
+				profile = std::move(initialProfile.value());
+			else
+				throw std::runtime_error("Invalid MOCK_PROFILE: " + error);
+		}
+
+		mg_mgr mgr;
+		mg_mgr_init(&mgr);
+
+		std::experimental::scope_exit mgrFree([&]() { mg_mgr_free(&mgr); });
+
+		if (!mg_http_listen(&mgr, Config::listenAddress.c_str(), httpHandler, nullptr))
+			throw std::runtime_error("Cannot listen on " + Config::listenAddress);
+
+		std::println("Mock processor listening on {}", Config::listenAddress);
+
+		while (!SignalHandling::shouldFinish())
+		{
+			mg_mgr_poll(&mgr, Config::pollTime);
+			sendDueReplies(mgr);
+		}
+
+		std::println("Exiting");
+
+		return 0;
+	}
+}  // namespace rinhaback::mock
+
+int main()
+{
+	using namespace rinhaback::mock;
+
+	try
+	{
+		return run();
+	}
+	catch (const std::exception& e)
+	{
+		std::println(stderr, "{}", e.what());
+		return 1;
+	}
+}